@@ -2,11 +2,17 @@
 #include <bits/stdc++.h>
 #include <cstdint>
 #include <chrono>
+#if defined(__x86_64__)
+#include <cpuid.h>
+#endif
 
 // Constants
 constexpr int BOARD_SIZE = 64;
 constexpr int MAX_MOVES = 218; // Maximum possible moves in a position
 constexpr int INF = 1000000;
+constexpr int MAX_PLY = 128; // Deepest search line, sizes the per-ply stacks
+constexpr int MATE = 32000;  // Score of being mated now, mate in n plies scores MATE - n
+constexpr int MATE_IN_MAX_PLY = MATE - MAX_PLY; // Scores beyond this are mate scores
 
 // Piece definitions
 enum Piece {
@@ -15,18 +21,19 @@ enum Piece {
     EMPTY
 };
 
-// Directions for sliding pieces
-// Define separate direction arrays
-const int bishop_directions[4] = {-9, -7, 7, 9};  // Diagonal directions
-const int rook_directions[4] = {-8, -1, 1, 8};    // Vertical and horizontal directions
-const int queen_directions[8] = {-9, -8, -7, -1, 1, 7, 8, 9}; // All directions
+// Piece steps as (file, rank) deltas
+constexpr int bishop_deltas[4][2] = {{1, 1}, {-1, 1}, {-1, -1}, {1, -1}};
+constexpr int rook_deltas[4][2] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+constexpr int knight_steps[8][2] = {{2, 1}, {1, 2}, {-1, 2}, {-2, 1}, {-2, -1}, {-1, -2}, {1, -2}, {2, -1}};
+constexpr int king_steps[8][2] = {{1, 0}, {1, 1}, {0, 1}, {-1, 1}, {-1, 0}, {-1, -1}, {0, -1}, {1, -1}};
+constexpr int pawn_steps[2][2][2] = {{{-1, 1}, {1, 1}}, {{-1, -1}, {1, -1}}}; // White, Black captures
 
-const int piece_value[2][5] = {
+constexpr int piece_value[2][5] = {
         {124, 781, 825, 1276, 2538}, // middle game
         {206, 854, 915, 1380, 2682}  // end game
 };
 
-const int psqt[2][5][8][4] = {
+constexpr int psqt[2][5][8][4] = {
         {
                 {
                     {-175, -92, -74, -73},
@@ -56,25 +63,213 @@ const int psqt[2][5][8][4] = {
         }
 };
 
-const int pawn_psqt[2][8][8] = {
+constexpr int pawn_psqt[2][8][8] = {
         {{0,0,0,0,0,0,0,0},{3,3,10,19,16,19,7,-5},{-9,-15,11,15,32,22,5,-22},{-4,-23,6,20,40,17,4,-8},{13,0,-13,1,11,-2,-13,5},
          {5,-12,-7,22,-8,-5,-15,-8},{-7,7,-3,-13,5,-16,10,-8},{0,0,0,0,0,0,0,0}},
         {{0,0,0,0,0,0,0,0},{-10,-6,10,0,14,7,-5,-19},{-10,-10,-10,4,4,3,-6,-4},{6,-2,-8,-4,-13,-12,-10,-9},{10,5,4,-5,-5,-5,14,9},
          {28,20,21,28,30,7,6,13},{0,-11,12,21,25,19,4,7},{0,0,0,0,0,0,0,0}}
 };
 
+// Middle game and end game values packed in one int, eg in the upper half, so both are summed with one add
+typedef int Score;
+
+constexpr Score make_score(int mg, int eg) {
+    return int(unsigned(eg) << 16) + mg;
+}
+
+constexpr int mg_value(Score s) {
+    return int16_t(uint16_t(unsigned(s)));
+}
+
+constexpr int eg_value(Score s) {
+    return int16_t(uint16_t(unsigned(s + 0x8000) >> 16));
+}
+
+// Game phase from the non-pawn material of both sides: PHASE_MIDGAME at or above MIDGAME_LIMIT,
+// 0 at or below ENDGAME_LIMIT, linear in between
+constexpr int MIDGAME_LIMIT = 15258;
+constexpr int ENDGAME_LIMIT = 3915;
+constexpr int PHASE_MIDGAME = 128;
+
+// Material plus piece-square value of every piece on every square, both phases packed, from White's view:
+// black pieces are mirrored rank-wise and negated, so a position's score is the plain sum over its pieces
+struct PieceSquareTable {
+    Score values[12][64];
+};
+
+constexpr PieceSquareTable make_piece_square_table() {
+    PieceSquareTable table{};
+    for (int type = WP; type <= WK; type++) {
+        for (int sq = 0; sq < 64; sq++) {
+            int rank = sq / 8, file = sq % 8, edge = std::min(file, 7 - file);
+            Score s = 0;
+            if (type == WP)
+                s = make_score(piece_value[0][WP] + pawn_psqt[0][rank][file],
+                               piece_value[1][WP] + pawn_psqt[1][rank][file]);
+            else if (type == WK) // The king has no material value, only the last psqt table
+                s = make_score(psqt[0][4][rank][edge], psqt[1][4][rank][edge]);
+            else
+                s = make_score(piece_value[0][type] + psqt[0][type - 1][rank][edge],
+                               piece_value[1][type] + psqt[1][type - 1][rank][edge]);
+            table.values[type][sq] = s;
+            table.values[type + 6][sq ^ 56] = -s;
+        }
+    }
+    return table;
+}
+
+constexpr PieceSquareTable PieceSquare = make_piece_square_table();
+
 // Bitboard typedef
 typedef uint64_t Bitboard;
 
+// xorshift64* generator (Vigna), usable at compile time
+struct PRNG {
+    uint64_t s;
+
+    explicit constexpr PRNG(uint64_t seed) : s(seed) {}
+
+    constexpr uint64_t rand() {
+        s ^= s >> 12;
+        s ^= s << 25;
+        s ^= s >> 27;
+        return s * 2685821657736338717ULL;
+    }
+};
+
+// Zobrist hashing keys
+struct ZobristKeys {
+    uint64_t pieces[12][64]; // Also indexed by piece count for the material key
+    uint64_t castling[16];   // Indexed by the castling rights bitmask
+    uint64_t en_passant[8];  // Indexed by file
+    uint64_t black_to_move;
+};
+
+constexpr ZobristKeys make_zobrist_keys() {
+    PRNG rng(1070372); // Fixed seed, so keys are identical across runs and builds
+    ZobristKeys keys{};
+    for (auto &piece: keys.pieces) {
+        for (auto &key: piece) key = rng.rand();
+    }
+    for (auto &key: keys.castling) key = rng.rand();
+    for (auto &key: keys.en_passant) key = rng.rand();
+    keys.black_to_move = rng.rand();
+    return keys;
+}
+
+constexpr ZobristKeys Zobrist = make_zobrist_keys();
+
+// Move flags, stored in the top 4 bits of a Move
+enum MoveFlag {
+    NORMAL,
+    DOUBLE_PUSH,
+    CASTLING,    // King move, the rook is moved alongside
+    EN_PASSANT,
+    PROMO_N,     // PROMO_N..PROMO_Q follow the order of WN..WQ
+    PROMO_B,
+    PROMO_R,
+    PROMO_Q
+};
+
+// Move structure, packed into 16 bits: from (bits 0-5), to (bits 6-11), flag (bits 12-15)
+struct Move {
+    uint16_t data;
+
+    Move() = default;
+    constexpr Move(int from, int to, int flag = NORMAL) : data(uint16_t(from | (to << 6) | (flag << 12))) {}
+
+    int from() const { return data & 0x3F; }
+    int to() const { return (data >> 6) & 0x3F; }
+    int flag() const { return data >> 12; }
+    bool is_promotion() const { return flag() >= PROMO_N; }
+
+    // Promoted piece for the given side, only meaningful if is_promotion()
+    int promotion(bool white) const { return flag() - PROMO_N + (white ? WN : BN); }
+
+    bool operator==(Move other) const { return data == other.data; }
+    bool operator!=(Move other) const { return data != other.data; }
+};
+
+static_assert(sizeof(Move) == 2, "Move must pack into 16 bits");
+
+constexpr Move MOVE_NONE = Move(0, 0); // No move, e.g. an empty best-move slot
+constexpr Move MOVE_NULL = Move(1, 1); // Passing the turn
+
+// Fixed-capacity move list with inline storage, so generating moves never touches the heap
+struct MoveList {
+    Move moves[MAX_MOVES];
+    int count = 0;
+
+    template<typename... Args>
+    void emplace_back(Args... args) {
+        assert(count < MAX_MOVES);
+        moves[count++] = Move(args...);
+    }
+
+    int size() const { return count; }
+    bool empty() const { return count == 0; }
+    void clear() { count = 0; }
+
+    Move &operator[](int i) { return moves[i]; }
+    const Move &operator[](int i) const { return moves[i]; }
+
+    Move *begin() { return moves; }
+    Move *end() { return moves + count; }
+    const Move *begin() const { return moves; }
+    const Move *end() const { return moves + count; }
+};
+
+// Castling rights bits
+enum CastlingRight {
+    CASTLE_WK = 1,
+    CASTLE_WQ = 2,
+    CASTLE_BK = 4,
+    CASTLE_BQ = 8
+};
+
+// Castling rights lost when a piece moves from or to 'square'
+inline int castling_lost(int square) {
+    switch (square) {
+        case 0: return CASTLE_WQ;              // a1
+        case 4: return CASTLE_WK | CASTLE_WQ;  // e1
+        case 7: return CASTLE_WK;              // h1
+        case 56: return CASTLE_BQ;             // a8
+        case 60: return CASTLE_BK | CASTLE_BQ; // e8
+        case 63: return CASTLE_BK;             // h8
+        default: return 0;
+    }
+}
+
+// Irreversible state saved by make_move, so unmake_move can restore it
+struct StateInfo {
+    int captured;        // Captured piece, EMPTY if none
+    int castling_rights;
+    int en_passant;
+    int ply;
+    uint64_t key;
+    uint64_t pawn_key;
+    uint64_t material_key;
+};
+
 // Board structure
 struct Board {
     Bitboard pieces[12] = {0}; // WP, WN, WB, WR, WQ, WK, BP, BN, BB, BR, BQ, BK
     Bitboard occupancy[3] = {0}; // White, Black
     bool white_to_move = true;
-    bool castling_rights[4] = {true, true, true, true}; // WK, WQ, BK, BQ
+    int castling_rights = CASTLE_WK | CASTLE_WQ | CASTLE_BK | CASTLE_BQ; // Bitmask of CastlingRight
     int en_passant = -1; // Square index for en passant
     int ply = 0; // Half-move count
     int fullmove_number = 1; // Full move number
+    uint8_t mailbox[64]; // Piece on each square, EMPTY if none; mirrors 'pieces'
+    uint64_t key = 0; // Zobrist hash of pieces, side to move, castling rights and en passant file
+    uint64_t pawn_key = 0; // Zobrist hash of the pawns only
+    uint64_t material_key = 0; // Zobrist hash of the piece counts
+    int non_pawn_material = 0; // Middle game value of all knights, bishops, rooks and queens
+    Score psq = 0; // Sum of PieceSquare over all pieces
+
+    Board() {
+        std::fill(std::begin(mailbox), std::end(mailbox), uint8_t(EMPTY));
+    }
 
     // Converts algebraic square notation to square index
     static int algebraic_to_index(const std::string &square) {
@@ -91,11 +286,12 @@ struct Board {
     void import_fen(const std::string &fen) {
         // Reset all bitboards
         for (int p = 0; p < 12; ++p) pieces[p] = 0;
+        std::fill(std::begin(mailbox), std::end(mailbox), uint8_t(EMPTY));
         occupancy[0] = 0;
         occupancy[1] = 0;
         occupancy[2] = 0;
         white_to_move = true;
-        for (int i = 0; i < 4; ++i) castling_rights[i] = false;
+        castling_rights = 0;
         en_passant = -1;
         ply = 0;
         fullmove_number = 1;
@@ -159,6 +355,7 @@ struct Board {
                 }
                 if (piece != -1) {
                     pieces[piece] |= (1ULL << square);
+                    mailbox[square] = piece;
                     if (piece < 6) {
                         occupancy[0] |= (1ULL << square); // White
                     } else {
@@ -178,16 +375,16 @@ struct Board {
             for (char c: castling) {
                 switch (c) {
                     case 'K':
-                        castling_rights[0] = true;
+                        castling_rights |= CASTLE_WK;
                         break; // White Kingside
                     case 'Q':
-                        castling_rights[1] = true;
+                        castling_rights |= CASTLE_WQ;
                         break; // White Queenside
                     case 'k':
-                        castling_rights[2] = true;
+                        castling_rights |= CASTLE_BK;
                         break; // Black Kingside
                     case 'q':
-                        castling_rights[3] = true;
+                        castling_rights |= CASTLE_BQ;
                         break; // Black Queenside
                     default:
                         break; // Ignore invalid characters
@@ -213,6 +410,8 @@ struct Board {
         if (!fullmove_str.empty()) {
             fullmove_number = std::stoi(fullmove_str);
         }
+
+        compute_keys();
     }
 
     // Initialize to starting position
@@ -235,40 +434,176 @@ struct Board {
         occupancy[0] = pieces[WP] | pieces[WN] | pieces[WB] | pieces[WR] | pieces[WQ] | pieces[WK];
         occupancy[1] = pieces[BP] | pieces[BN] | pieces[BB] | pieces[BR] | pieces[BQ] | pieces[BK];
         occupancy[2] = occupancy[0] | occupancy[1];
+        // Mailbox
+        std::fill(std::begin(mailbox), std::end(mailbox), uint8_t(EMPTY));
+        for (int p = 0; p < 12; p++) {
+            Bitboard bb = pieces[p];
+            while (bb) {
+                int sq = __builtin_ctzll(bb);
+                bb &= bb - 1;
+                mailbox[sq] = p;
+            }
+        }
+        compute_keys();
     }
 
-    // Get piece at square
-    int get_piece(int square) const {
+    // Recomputes all hash keys, the non-pawn material and the piece-square score from scratch
+    void compute_keys() {
+        key = pawn_key = material_key = 0;
+        non_pawn_material = 0;
+        psq = 0;
         for (int p = 0; p < 12; p++) {
-            if (pieces[p] & (1ULL << square)) return p;
+            Bitboard bb = pieces[p];
+            for (int count = 0; bb; count++) {
+                int sq = __builtin_ctzll(bb);
+                bb &= bb - 1;
+                key ^= Zobrist.pieces[p][sq];
+                if (p == WP || p == BP) pawn_key ^= Zobrist.pieces[p][sq];
+                material_key ^= Zobrist.pieces[p][count];
+                if (p % 6 != WP && p % 6 != WK) non_pawn_material += piece_value[0][p % 6];
+                psq += PieceSquare.values[p][sq];
+            }
         }
-        return EMPTY;
+        key ^= Zobrist.castling[castling_rights];
+        if (en_passant != -1) key ^= Zobrist.en_passant[en_passant % 8];
+        if (!white_to_move) key ^= Zobrist.black_to_move;
     }
 
-    // Set piece at square
-    void set_piece(int square, int piece) {
-        for (unsigned long long &p: pieces) {
-            p &= ~(1ULL << square);
-        }
-        if (piece != EMPTY) {
-            pieces[piece] |= (1ULL << square);
-            occupancy[piece < 6 ? 0 : 1] |= (1ULL << square);
-            occupancy[2] |= (1ULL << square);
-        } else {
-            occupancy[0] &= ~(1ULL << square);
-            occupancy[1] &= ~(1ULL << square);
-            occupancy[2] &= ~(1ULL << square);
+    // Get piece at square
+    int get_piece(int square) const {
+        return mailbox[square];
+    }
+
+    // Places 'piece' on the empty 'square'
+    void put_piece(int piece, int square) {
+        Bitboard bb = 1ULL << square;
+        pieces[piece] ^= bb;
+        occupancy[piece < 6 ? 0 : 1] ^= bb;
+        occupancy[2] ^= bb;
+        mailbox[square] = piece;
+        key ^= Zobrist.pieces[piece][square];
+        if (piece == WP || piece == BP) pawn_key ^= Zobrist.pieces[piece][square];
+        material_key ^= Zobrist.pieces[piece][__builtin_popcountll(pieces[piece]) - 1];
+        if (piece % 6 != WP && piece % 6 != WK) non_pawn_material += piece_value[0][piece % 6];
+        psq += PieceSquare.values[piece][square];
+    }
+
+    // Removes 'piece' from 'square'
+    void remove_piece(int piece, int square) {
+        Bitboard bb = 1ULL << square;
+        pieces[piece] ^= bb;
+        occupancy[piece < 6 ? 0 : 1] ^= bb;
+        occupancy[2] ^= bb;
+        mailbox[square] = EMPTY;
+        key ^= Zobrist.pieces[piece][square];
+        if (piece == WP || piece == BP) pawn_key ^= Zobrist.pieces[piece][square];
+        material_key ^= Zobrist.pieces[piece][__builtin_popcountll(pieces[piece])];
+        if (piece % 6 != WP && piece % 6 != WK) non_pawn_material -= piece_value[0][piece % 6];
+        psq -= PieceSquare.values[piece][square];
+    }
+
+    // Plays a pseudo-legal move, saving what cannot be recomputed into 'st'
+    void make_move(Move move, StateInfo &st) {
+        int from = move.from();
+        int to = move.to();
+        int flag = move.flag();
+        int piece = get_piece(from);
+        int capture_square = flag == EN_PASSANT ? (white_to_move ? to - 8 : to + 8) : to;
+
+        st.captured = get_piece(capture_square);
+        st.castling_rights = castling_rights;
+        st.en_passant = en_passant;
+        st.ply = ply;
+        st.key = key;
+        st.pawn_key = pawn_key;
+        st.material_key = material_key;
+
+        if (st.captured != EMPTY) remove_piece(st.captured, capture_square);
+        remove_piece(piece, from);
+        put_piece(move.is_promotion() ? move.promotion(white_to_move) : piece, to);
+
+        if (flag == CASTLING) {
+            // Rook jumps from the corner to the square the king passed
+            int rook = white_to_move ? WR : BR;
+            bool kingside = to > from;
+            remove_piece(rook, kingside ? from + 3 : from - 4);
+            put_piece(rook, kingside ? from + 1 : from - 1);
         }
+
+        key ^= Zobrist.castling[castling_rights];
+        castling_rights &= ~(castling_lost(from) | castling_lost(to));
+        key ^= Zobrist.castling[castling_rights];
+
+        if (en_passant != -1) key ^= Zobrist.en_passant[en_passant % 8];
+        en_passant = flag == DOUBLE_PUSH ? (from + to) / 2 : -1;
+        if (en_passant != -1) key ^= Zobrist.en_passant[en_passant % 8];
+
+        ply = (piece == WP || piece == BP || st.captured != EMPTY) ? 0 : ply + 1;
+        if (!white_to_move) fullmove_number++;
+        white_to_move = !white_to_move;
+        key ^= Zobrist.black_to_move;
     }
-};
 
-// Move structure
-struct Move {
-    int from;
-    int to;
-    int promotion; // EMPTY if not a promotion
+    // Passes the turn, for null-move pruning
+    void make_null_move(StateInfo &st) {
+        st.captured = EMPTY;
+        st.castling_rights = castling_rights;
+        st.en_passant = en_passant;
+        st.ply = ply;
+        st.key = key;
+        st.pawn_key = pawn_key;
+        st.material_key = material_key;
+
+        if (en_passant != -1) key ^= Zobrist.en_passant[en_passant % 8];
+        en_passant = -1;
+        ply++;
+        white_to_move = !white_to_move;
+        key ^= Zobrist.black_to_move;
+    }
+
+    void unmake_null_move(const StateInfo &st) {
+        white_to_move = !white_to_move;
+        en_passant = st.en_passant;
+        ply = st.ply;
+        key = st.key;
+    }
+
+    // Takes back 'move', which must be the last move made with 'st'
+    void unmake_move(Move move, const StateInfo &st) {
+        white_to_move = !white_to_move;
+        if (!white_to_move) fullmove_number--;
+
+        int from = move.from();
+        int to = move.to();
+        int flag = move.flag();
+        int piece = move.is_promotion() ? (white_to_move ? WP : BP) : get_piece(to);
+        int capture_square = flag == EN_PASSANT ? (white_to_move ? to - 8 : to + 8) : to;
+
+        if (flag == CASTLING) {
+            int rook = white_to_move ? WR : BR;
+            bool kingside = to > from;
+            remove_piece(rook, kingside ? from + 1 : from - 1);
+            put_piece(rook, kingside ? from + 3 : from - 4);
+        }
+
+        remove_piece(move.is_promotion() ? move.promotion(white_to_move) : piece, to);
+        put_piece(piece, from);
+        if (st.captured != EMPTY) put_piece(st.captured, capture_square);
+
+        castling_rights = st.castling_rights;
+        en_passant = st.en_passant;
+        ply = st.ply;
+        key = st.key;
+        pawn_key = st.pawn_key;
+        material_key = st.material_key;
+    }
 
-    explicit Move(int f = 0, int t = 0, int p = EMPTY) : from(f), to(t), promotion(p) {}
+    // Set piece at square
+    void set_piece(int square, int piece) {
+        int old = mailbox[square];
+        if (old != EMPTY) remove_piece(old, square);
+        if (piece != EMPTY) put_piece(piece, square);
+    }
 };
 
 // Utility functions
@@ -278,317 +613,531 @@ inline int pop_lsb(Bitboard &bb) {
     return sq;
 }
 
-int pinned_direction(const Board& board, int square) {
-    // Check if the square has a piece
-    int piece = board.get_piece(square);
-    if(piece == EMPTY) return 0;
+inline int popcount(Bitboard bb) {
+    return __builtin_popcountll(bb);
+}
 
-    // Determine color: 1 for White, -1 for Black
-    int color = (piece < 6) ? 1 : -1;
+constexpr Bitboard FILE_A = 0x0101010101010101ULL;
+constexpr Bitboard FILE_H = FILE_A << 7;
+constexpr Bitboard RANK_1 = 0xFFULL;
+constexpr Bitboard RANK_8 = RANK_1 << 56;
+
+// The same position with colours swapped and the board mirrored rank-wise: a white pawn on e2
+// becomes a black pawn on e7 and the other side is to move. Mirroring a bitboard is a byte swap.
+Board colorflip(const Board &board) {
+    Board flipped;
+    for (int p = 0; p < 6; ++p) {
+        flipped.pieces[p] = __builtin_bswap64(board.pieces[p + 6]);
+        flipped.pieces[p + 6] = __builtin_bswap64(board.pieces[p]);
+    }
+    flipped.occupancy[0] = __builtin_bswap64(board.occupancy[1]);
+    flipped.occupancy[1] = __builtin_bswap64(board.occupancy[0]);
+    flipped.occupancy[2] = __builtin_bswap64(board.occupancy[2]);
+    flipped.white_to_move = !board.white_to_move;
+    flipped.castling_rights = (board.castling_rights & (CASTLE_WK | CASTLE_WQ)) << 2 | board.castling_rights >> 2;
+    flipped.en_passant = board.en_passant == -1 ? -1 : board.en_passant ^ 56;
+    flipped.ply = board.ply;
+    flipped.fullmove_number = board.fullmove_number;
+
+    // Mailbox rows in reverse order, with all eight bytes of a row recoloured at once:
+    // pieces below 6 gain 6, pieces 6 to 11 lose 6, EMPTY (12) stays
+    constexpr uint64_t high_bits = 0x8080808080808080ULL;
+    for (int r = 0; r < 8; ++r) {
+        uint64_t row;
+        std::memcpy(&row, board.mailbox + 8 * (7 - r), 8);
+        uint64_t black = (row + 0x7A7A7A7A7A7A7A7AULL) & high_bits; // Bytes >= 6
+        uint64_t empty = (row + 0x7474747474747474ULL) & high_bits; // Bytes >= 12
+        row += ((~black & high_bits) >> 7) * 6;
+        row -= ((black & ~empty) >> 7) * 6;
+        std::memcpy(flipped.mailbox + 8 * r, &row, 8);
+    }
 
-    // Define direction vectors and their corresponding direction codes
-    struct Direction {
-        int dx;
-        int dy;
-        int code;
-    };
+    flipped.compute_keys();
+    return flipped;
+}
 
-    Direction directions[8] = {
-            {1, 0, 1},   // East - horizontal
-            {-1, 0, 1},  // West - horizontal
-            {0, 1, 3},   // North - vertical
-            {0, -1, 3},  // South - vertical
-            {1, 1, 2},   // Northeast - topleft to bottomright
-            {-1, 1, 4},  // Northwest - topright to bottomleft
-            {-1, -1, 4}, // Southwest - topright to bottomleft
-            {1, -1, 2}    // Southeast - topleft to bottomright
-    };
+// Slider table indexing schemes; both share the same table layout and attack sets
+enum SliderBackend {
+    MAGIC_BACKEND, // Multiply and shift, runs everywhere
+    PEXT_BACKEND   // BMI2 parallel bit extract
+};
 
-    // Helper functions to get file and rank from square
-    auto get_file = [](int sq) -> int { return sq %8; };
-    auto get_rank = [](int sq) -> int { return sq /8; };
+SliderBackend slider_backend = MAGIC_BACKEND;
 
-    int x = get_file(square);
-    int y = get_rank(square);
+#if defined(__x86_64__)
+// Inline asm rather than _pext_u64, which cannot be inlined into code not built for BMI2.
+// Only reached with the PEXT backend, which is only used on CPUs with BMI2.
+inline uint64_t pext(uint64_t bb, uint64_t mask) {
+    uint64_t result;
+    asm("pextq %2, %1, %0" : "=r"(result) : "r"(bb), "rm"(mask));
+    return result;
+}
 
-    for(int i = 0; i < 8; i++){
-        int dx = directions[i].dx;
-        int dy = directions[i].dy;
-        int code = directions[i].code;
+inline bool cpu_has_bmi2() {
+    return __builtin_cpu_supports("bmi2");
+}
 
-        int current_x = x + dx;
-        int current_y = y + dy;
+// AMD before Zen 3 (family 19h), and Hygon's Zen-based parts, run PEXT in microcode, far slower
+// than a magic multiply
+inline bool cpu_has_fast_pext() {
+    if (!cpu_has_bmi2()) return false;
+    unsigned eax = 0, ebx = 0, ecx = 0, edx = 0;
+    __get_cpuid(0, &eax, &ebx, &ecx, &edx);
+    bool amd = ebx == 0x68747541 && edx == 0x69746e65 && ecx == 0x444d4163;   // "AuthenticAMD"
+    bool hygon = ebx == 0x6f677948 && edx == 0x6e65476e && ecx == 0x656e6975; // "HygonGenuine"
+    if (hygon) return false;
+    if (!amd) return true;
+    __get_cpuid(1, &eax, &ebx, &ecx, &edx);
+    unsigned family = (eax >> 8) & 0xF;
+    if (family == 0xF) family += (eax >> 20) & 0xFF;
+    return family >= 0x19;
+}
+#else
+// Portable fallback, never selected since cpu_has_bmi2() is false here
+inline uint64_t pext(uint64_t bb, uint64_t mask) {
+    uint64_t result = 0;
+    for (uint64_t bit = 1; mask; bit <<= 1, mask &= mask - 1) {
+        if (bb & mask & -mask) result |= bit;
+    }
+    return result;
+}
 
-        bool king_found = false;
+inline bool cpu_has_bmi2() {
+    return false;
+}
 
-        // Traverse in the direction until a blocker or the edge of the board
-        while(current_x >=0 && current_x <8 && current_y >=0 && current_y <8){
-            int current_square = current_y *8 + current_x;
-            int current_piece = board.get_piece(current_square);
+inline bool cpu_has_fast_pext() {
+    return false;
+}
+#endif
 
-            if(current_piece == EMPTY){
-                current_x += dx;
-                current_y += dy;
-                continue;
-            }
+// Picks the fastest backend the running CPU supports
+SliderBackend detect_slider_backend() {
+    return cpu_has_fast_pext() ? PEXT_BACKEND : MAGIC_BACKEND;
+}
 
-            if( (current_piece == (color ==1 ? WK : BK)) ){
-                king_found = true;
-                break;
-            }
-            else{
-                // A piece is blocking, not the king
-                break;
-            }
+// Attack sets of a non-sliding piece on every square, built at compile time
+template<int N>
+constexpr std::array<Bitboard, 64> leaper_attacks(const int (&steps)[N][2]) {
+    std::array<Bitboard, 64> table{};
+    for (int sq = 0; sq < 64; ++sq) {
+        for (int i = 0; i < N; ++i) {
+            int x = sq % 8 + steps[i][0];
+            int y = sq / 8 + steps[i][1];
+            if (x >= 0 && x < 8 && y >= 0 && y < 8) table[sq] |= 1ULL << (y * 8 + x);
         }
+    }
+    return table;
+}
 
-        if(king_found){
-            // Now, check in the opposite direction for an enemy sliding piece that can attack along this direction.
-            int opp_x = x - dx;
-            int opp_y = y - dy;
-
-            while(opp_x >=0 && opp_x <8 && opp_y >=0 && opp_y <8){
-                int opp_square = opp_y *8 + opp_x;
-                int opp_piece = board.get_piece(opp_square);
-
-                if(opp_piece == EMPTY){
-                    opp_x -= dx;
-                    opp_y -= dy;
-                    continue;
-                }
-
-                // Check if the piece is an enemy sliding piece that can attack along this direction.
-                bool is_enemy = (color ==1 && opp_piece >= BP && opp_piece <= BK) ||
-                                (color ==-1 && opp_piece >= WP && opp_piece <= WK);
-
-                if(is_enemy){
-                    bool is_attacking_piece = false;
-                    // Determine if the enemy piece can attack in this direction
-                    if(code ==1){ // Horizontal
-                        if(opp_piece == WR || opp_piece == WQ || opp_piece == BR || opp_piece == BQ){
-                            is_attacking_piece = true;
-                        }
-                    }
-                    else if(code ==2 || code ==4){ // Diagonal
-                        if(opp_piece == WB || opp_piece == WQ || opp_piece == BB || opp_piece == BQ){
-                            is_attacking_piece = true;
-                        }
-                    }
-                    else if(code ==3){ // Vertical
-                        if(opp_piece == WR || opp_piece == WQ || opp_piece == BR || opp_piece == BQ){
-                            is_attacking_piece = true;
-                        }
-                    }
-
-                    if(is_attacking_piece){
-                        // Direction code is 1,2,3,4. Multiply by color.
-                        return code * color;
-                    }
+constexpr std::array<Bitboard, 64> KnightAttacks = leaper_attacks(knight_steps);
+constexpr std::array<Bitboard, 64> KingAttacks = leaper_attacks(king_steps);
+// PawnAttacks[0][sq]: squares a white pawn on sq attacks, PawnAttacks[1][sq]: same for black
+constexpr std::array<Bitboard, 64> PawnAttacks[2] = {leaper_attacks(pawn_steps[0]), leaper_attacks(pawn_steps[1])};
+
+// For every pair of squares on a common rank, file or diagonal: the squares strictly between
+// them, or the whole line through both from edge to edge. Zero for unaligned pairs.
+constexpr std::array<std::array<Bitboard, 64>, 64> line_table(bool whole_line) {
+    std::array<std::array<Bitboard, 64>, 64> table{};
+    for (int a = 0; a < 64; ++a) {
+        for (int d = 0; d < 8; ++d) {
+            int dx = d < 4 ? rook_deltas[d][0] : bishop_deltas[d - 4][0];
+            int dy = d < 4 ? rook_deltas[d][1] : bishop_deltas[d - 4][1];
+
+            // Both halves of the line through 'a' in this direction
+            Bitboard line = 1ULL << a;
+            for (int sign = -1; sign <= 1; sign += 2) {
+                for (int x = a % 8 + sign * dx, y = a / 8 + sign * dy; x >= 0 && x < 8 && y >= 0 && y < 8;
+                     x += sign * dx, y += sign * dy) {
+                    line |= 1ULL << (y * 8 + x);
                 }
+            }
 
-                // If enemy piece is not a sliding attacker, no pin.
-                break;
+            Bitboard between = 0;
+            for (int x = a % 8 + dx, y = a / 8 + dy; x >= 0 && x < 8 && y >= 0 && y < 8; x += dx, y += dy) {
+                table[a][y * 8 + x] = whole_line ? line : between;
+                between |= 1ULL << (y * 8 + x);
             }
         }
     }
-
-    // No pin found
-    return 0;
+    return table;
 }
 
-int pinned(const Board& board, int square) {
-    return (pinned_direction(board, square) > 0) ? 1 : 0;
+constexpr std::array<std::array<Bitboard, 64>, 64> BetweenBB = line_table(false);
+constexpr std::array<std::array<Bitboard, 64>, 64> LineBB = line_table(true);
+
+// Squares in front of a square from one side's point of view, on its own file and/or the two
+// adjacent files. Rows are indexed by colour, 0 for White.
+constexpr std::array<Bitboard, 64> front_span(bool white, bool own_file, bool adjacent_files) {
+    std::array<Bitboard, 64> table{};
+    for (int sq = 0; sq < 64; ++sq) {
+        for (int y = sq / 8 + (white ? 1 : -1); y >= 0 && y < 8; y += white ? 1 : -1) {
+            for (int x = sq % 8 - 1; x <= sq % 8 + 1; ++x) {
+                if (x < 0 || x > 7 || (x == sq % 8 ? !own_file : !adjacent_files)) continue;
+                table[sq] |= 1ULL << (y * 8 + x);
+            }
+        }
+    }
+    return table;
 }
 
-// Helper function: Converts (x, y) to square index
-inline int xy_to_square(int x, int y) {
-    if (x < 0 || x > 7 || y < 0 || y > 7) return -1;
-    return y * 8 + x;
+constexpr std::array<Bitboard, 64> ForwardFileBB[2] = {front_span(true, true, false), front_span(false, true, false)};
+// Squares a pawn could ever attack while advancing
+constexpr std::array<Bitboard, 64> PawnAttackSpan[2] = {front_span(true, false, true), front_span(false, false, true)};
+// A pawn is passed when no enemy pawn stands on these
+constexpr std::array<Bitboard, 64> PassedPawnMask[2] = {front_span(true, true, true), front_span(false, true, true)};
+
+constexpr Bitboard adjacent_files(int file) {
+    Bitboard bb = FILE_A << file;
+    return (bb & ~FILE_A) >> 1 | (bb & ~FILE_H) << 1;
 }
 
-// Counts the number of attacks on 'square' by enemy knights
-int knight_attack(const Board& board, int square, int s2 = -1) {
-    if (square < 0 || square >= 64) return 0; // Invalid square
+// Magic bitboard entry for one square: (occupied & mask) * magic >> shift indexes 'attacks'
+struct Magic {
+    Bitboard mask;     // Relevant occupancy, board edges excluded
+    Bitboard magic;
+    Bitboard *attacks; // Slice of bishop_table / rook_table owned by this square
+    int shift;
+
+    template<SliderBackend B>
+    unsigned index(Bitboard occupied) const {
+        if constexpr (B == PEXT_BACKEND) return unsigned(pext(occupied, mask));
+        else return unsigned(((occupied & mask) * magic) >> shift);
+    }
 
-    int attack_count = 0;
-    int x = square % 8;
-    int y = square / 8;
+    unsigned index(Bitboard occupied) const {
+        return slider_backend == PEXT_BACKEND ? index<PEXT_BACKEND>(occupied) : index<MAGIC_BACKEND>(occupied);
+    }
+};
 
-    // Define all 8 possible knight move offsets
-    const int knight_offsets[8][2] = {
-            {2, 1}, {1, 2}, {-1, 2}, {-2, 1},
-            {-2, -1}, {-1, -2}, {1, -2}, {2, -1}
-    };
+Magic bishop_magics[64];
+Magic rook_magics[64];
+Bitboard bishop_table[0x1480]; // Sum of 2^popcount(mask) over all squares
+Bitboard rook_table[0x19000];
+
+// Slow ray walk up to and including the first blocker, only used to fill the tables
+Bitboard sliding_attack(const int (*deltas)[2], int square, Bitboard occupied) {
+    Bitboard attacks = 0;
+    for (int d = 0; d < 4; ++d) {
+        int x = square % 8 + deltas[d][0];
+        int y = square / 8 + deltas[d][1];
+        while (x >= 0 && x < 8 && y >= 0 && y < 8) {
+            Bitboard bb = 1ULL << (y * 8 + x);
+            attacks |= bb;
+            if (occupied & bb) break;
+            x += deltas[d][0];
+            y += deltas[d][1];
+        }
+    }
+    return attacks;
+}
 
-    for (int i = 0; i < 8; ++i) {
-        int target_x = x + knight_offsets[i][0];
-        int target_y = y + knight_offsets[i][1];
-        int target_square = xy_to_square(target_x, target_y);
-        if (target_square == -1) continue; // Out of bounds
+// Magic multipliers, found offline with a fixed-seed search over sparse random numbers
+const Bitboard bishop_magic_numbers[64] = {
+        0x40106000a1160020ULL, 0x0020010250810120ULL, 0x2010010220280081ULL, 0x002806004050c040ULL,
+        0x0002021018000000ULL, 0x2001112010000400ULL, 0x0881010120218080ULL, 0x1030820110010500ULL,
+        0x0000120222042400ULL, 0x2000020404040044ULL, 0x8000480094208000ULL, 0x0003422a02000001ULL,
+        0x000a220210100040ULL, 0x8004820202226000ULL, 0x0018234854100800ULL, 0x0100004042101040ULL,
+        0x0004001004082820ULL, 0x0010000810010048ULL, 0x1014004208081300ULL, 0x2080818802044202ULL,
+        0x0040880c00a00100ULL, 0x0080400200522010ULL, 0x0001000188180b04ULL, 0x0080249202020204ULL,
+        0x1004400004100410ULL, 0x00013100a0022206ULL, 0x2148500001040080ULL, 0x4241080011004300ULL,
+        0x4020848004002000ULL, 0x10101380d1004100ULL, 0x0008004422020284ULL, 0x01010a1041008080ULL,
+        0x0808080400082121ULL, 0x0808080400082121ULL, 0x0091128200100c00ULL, 0x0202200802010104ULL,
+        0x8c0a020200440085ULL, 0x01a0008080b10040ULL, 0x0889520080122800ULL, 0x100902022202010aULL,
+        0x04081a0816002000ULL, 0x0000681208005000ULL, 0x8170840041008802ULL, 0x0a00004200810805ULL,
+        0x0830404408210100ULL, 0x2602208106006102ULL, 0x1048300680802628ULL, 0x2602208106006102ULL,
+        0x0602010120110040ULL, 0x0941010801043000ULL, 0x000040440a210428ULL, 0x0008240020880021ULL,
+        0x0400002012048200ULL, 0x00ac102001210220ULL, 0x0220021002009900ULL, 0x84440c080a013080ULL,
+        0x0001008044200440ULL, 0x0004c04410841000ULL, 0x2000500104011130ULL, 0x1a0c010011c20229ULL,
+        0x0044800112202200ULL, 0x0434804908100424ULL, 0x0300404822c08200ULL, 0x48081010008a2a80ULL
+};
 
-        // If 's2' is specified, skip other squares
-        if (s2 != -1 && target_square != s2) continue;
+const Bitboard rook_magic_numbers[64] = {
+        0x0880004000108025ULL, 0x8040004010002008ULL, 0x2080200010008008ULL, 0x1100100008210004ULL,
+        0xc200209084020008ULL, 0x2100010004000208ULL, 0x0400081000822421ULL, 0x0200010422048844ULL,
+        0x0800800080400024ULL, 0x0001402000401000ULL, 0x3000801000802001ULL, 0x4400800800100083ULL,
+        0x0904802402480080ULL, 0x4040800400020080ULL, 0x0018808042000100ULL, 0x4040800080004100ULL,
+        0x0040048001458024ULL, 0x00a0004000205000ULL, 0x3100808010002000ULL, 0x4825010010000820ULL,
+        0x5004808008000401ULL, 0x2024818004000a00ULL, 0x0005808002000100ULL, 0x2100060004806104ULL,
+        0x0080400880008421ULL, 0x4062220600410280ULL, 0x010a004a00108022ULL, 0x0000100080080080ULL,
+        0x0021000500080010ULL, 0x0044000202001008ULL, 0x0000100400080102ULL, 0xc020128200040545ULL,
+        0x0080002000400040ULL, 0x0000804000802004ULL, 0x0000120022004080ULL, 0x010a386103001001ULL,
+        0x9010080080800400ULL, 0x8440020080800400ULL, 0x0004228824001001ULL, 0x000000490a000084ULL,
+        0x0080002000504000ULL, 0x200020005000c000ULL, 0x0012088020420010ULL, 0x0010010080080800ULL,
+        0x0085001008010004ULL, 0x0002000204008080ULL, 0x0040413002040008ULL, 0x0000304081020004ULL,
+        0x0080204000800080ULL, 0x3008804000290100ULL, 0x1010100080200080ULL, 0x2008100208028080ULL,
+        0x5000850800910100ULL, 0x8402019004680200ULL, 0x0120911028020400ULL, 0x0000008044010200ULL,
+        0x0020850200244012ULL, 0x0020850200244012ULL, 0x0000102001040841ULL, 0x140900040a100021ULL,
+        0x000200282410a102ULL, 0x000200282410a102ULL, 0x000200282410a102ULL, 0x4048240043802106ULL
+};
 
-        int piece = board.get_piece(target_square);
-        bool is_enemy_knight = board.white_to_move ? (piece == BN) : (piece == WN);
-        if (is_enemy_knight && !pinned(board, target_square)) {
-            attack_count++;
-        }
+// Computes masks and fills every square's attack slice for all subsets of its mask
+void init_magics(Magic magics[], Bitboard table[], const Bitboard magic_numbers[], const int (*deltas)[2]) {
+    Bitboard *base = table;
+
+    for (int sq = 0; sq < 64; ++sq) {
+        Magic &m = magics[sq];
+        Bitboard rank_bb = RANK_1 << (8 * (sq / 8));
+        Bitboard file_bb = FILE_A << (sq % 8);
+        Bitboard edges = ((RANK_1 | RANK_8) & ~rank_bb) | ((FILE_A | FILE_H) & ~file_bb);
+        m.mask = sliding_attack(deltas, sq, 0) & ~edges;
+        m.magic = magic_numbers[sq];
+        m.shift = 64 - popcount(m.mask);
+        m.attacks = base;
+
+        // Enumerate every subset of the mask (Carry-Rippler)
+        Bitboard b = 0;
+        do {
+            m.attacks[m.index(b)] = sliding_attack(deltas, sq, b);
+            b = (b - m.mask) & m.mask;
+        } while (b);
+        base += 1ULL << popcount(m.mask);
     }
+}
 
-    return attack_count;
+// Builds the slider attack tables for 'backend', must run before any move generation or evaluation.
+// Calling it again rebuilds the tables for another backend.
+void init_attack_tables(SliderBackend backend) {
+    slider_backend = backend;
+    init_magics(bishop_magics, bishop_table, bishop_magic_numbers, bishop_deltas);
+    init_magics(rook_magics, rook_table, rook_magic_numbers, rook_deltas);
 }
 
-// Counts the number of attacks on 'square' by enemy bishops (including x-ray through queens)
-int bishop_xray_attack(const Board& board, int square, int s2 = -1) {
-    if (square < 0 || square >= 64) return 0; // Invalid square
+// Slider lookups come in two flavours. The templates take the backend as a parameter and are used by
+// move generation and search, which pick the backend once per search, so the hot path has no branch
+// on it. The plain functions dispatch on 'slider_backend' at every call, for evaluation helpers,
+// setup and tests.
+template<SliderBackend B>
+inline Bitboard bishop_attacks(int square, Bitboard occupied) {
+    const Magic &m = bishop_magics[square];
+    return m.attacks[m.index<B>(occupied)];
+}
 
-    int attack_count = 0;
-    int x = square % 8;
-    int y = square / 8;
+template<SliderBackend B>
+inline Bitboard rook_attacks(int square, Bitboard occupied) {
+    const Magic &m = rook_magics[square];
+    return m.attacks[m.index<B>(occupied)];
+}
 
-    // Define the four diagonal directions
-    const int bishop_directions[4][2] = {
-            {1, 1}, {-1, 1}, {-1, -1}, {1, -1}
-    };
+template<SliderBackend B>
+inline Bitboard queen_attacks(int square, Bitboard occupied) {
+    return bishop_attacks<B>(square, occupied) | rook_attacks<B>(square, occupied);
+}
 
-    for (int i = 0; i < 4; ++i) {
-        int dx = bishop_directions[i][0];
-        int dy = bishop_directions[i][1];
-        int target_x = x + dx;
-        int target_y = y + dy;
+inline Bitboard bishop_attacks(int square, Bitboard occupied) {
+    const Magic &m = bishop_magics[square];
+    return m.attacks[m.index(occupied)];
+}
 
-        while (target_x >= 0 && target_x < 8 && target_y >= 0 && target_y < 8) {
-            int target_square = xy_to_square(target_x, target_y);
-            if (target_square == -1) break;
+inline Bitboard rook_attacks(int square, Bitboard occupied) {
+    const Magic &m = rook_magics[square];
+    return m.attacks[m.index(occupied)];
+}
 
-            int piece = board.get_piece(target_square);
+inline Bitboard queen_attacks(int square, Bitboard occupied) {
+    return bishop_attacks(square, occupied) | rook_attacks(square, occupied);
+}
 
-            if (piece == EMPTY) {
-                // Continue scanning in this direction
-                target_x += dx;
-                target_y += dy;
-                continue;
-            }
+// All pieces of both colours attacking 'square', with sliders blocked by 'occupied'
+template<SliderBackend B>
+inline Bitboard attackers_to(const Board &board, int square, Bitboard occupied) {
+    return (PawnAttacks[1][square] & board.pieces[WP]) |
+           (PawnAttacks[0][square] & board.pieces[BP]) |
+           (KnightAttacks[square] & (board.pieces[WN] | board.pieces[BN])) |
+           (KingAttacks[square] & (board.pieces[WK] | board.pieces[BK])) |
+           (bishop_attacks<B>(square, occupied) & (board.pieces[WB] | board.pieces[BB] |
+                                                   board.pieces[WQ] | board.pieces[BQ])) |
+           (rook_attacks<B>(square, occupied) & (board.pieces[WR] | board.pieces[BR] |
+                                                 board.pieces[WQ] | board.pieces[BQ]));
+}
 
-            // If 's2' is specified and doesn't match, skip
-            if (s2 != -1 && target_square != s2) break;
+inline Bitboard attackers_to(const Board &board, int square, Bitboard occupied) {
+    return slider_backend == PEXT_BACKEND ? attackers_to<PEXT_BACKEND>(board, square, occupied)
+                                          : attackers_to<MAGIC_BACKEND>(board, square, occupied);
+}
 
-            bool is_enemy_bishop_or_queen = board.white_to_move ?
-                                            (piece == BB || piece == BQ) :
-                                            (piece == WB || piece == WQ);
+// True if the side to move's king is attacked
+template<SliderBackend B>
+inline bool in_check(const Board &board) {
+    int king = board.white_to_move ? WK : BK;
+    Bitboard them = board.occupancy[board.white_to_move ? 1 : 0];
+    return board.pieces[king] &&
+           (attackers_to<B>(board, __builtin_ctzll(board.pieces[king]), board.occupancy[2]) & them);
+}
 
-            if (is_enemy_bishop_or_queen && !pinned(board, target_square)) {
-                attack_count++;
-            }
+inline bool in_check(const Board &board) {
+    return slider_backend == PEXT_BACKEND ? in_check<PEXT_BACKEND>(board) : in_check<MAGIC_BACKEND>(board);
+}
 
-            break; // Blocked by any piece
-        }
+// Pieces of the given side pinned to their own king: the only piece between it and an enemy
+// slider that would otherwise attack the king along that line
+template<SliderBackend B>
+Bitboard pinned_pieces(const Board &board, bool white) {
+    Bitboard king = board.pieces[white ? WK : BK];
+    if (!king) return 0;
+    int king_square = __builtin_ctzll(king);
+    Bitboard own = white ? board.occupancy[0] : board.occupancy[1];
+    Bitboard enemy = white ? board.occupancy[1] : board.occupancy[0];
+    int them = white ? 6 : 0;
+
+    // Enemy sliders that would attack the king if only their own pieces were on the board
+    Bitboard snipers = (rook_attacks<B>(king_square, enemy) & (board.pieces[WR + them] | board.pieces[WQ + them])) |
+                       (bishop_attacks<B>(king_square, enemy) & (board.pieces[WB + them] | board.pieces[WQ + them]));
+    Bitboard pinned = 0;
+    while (snipers) {
+        Bitboard blockers = BetweenBB[king_square][pop_lsb(snipers)] & board.occupancy[2];
+        if (blockers && !(blockers & (blockers - 1))) pinned |= blockers & own;
     }
+    return pinned;
+}
 
-    return attack_count;
+Bitboard pinned_pieces(const Board &board, bool white) {
+    return slider_backend == PEXT_BACKEND ? pinned_pieces<PEXT_BACKEND>(board, white)
+                                          : pinned_pieces<MAGIC_BACKEND>(board, white);
 }
 
-// Counts the number of attacks on 'square' by enemy rooks (including x-ray through queens)
-int rook_xray_attack(const Board& board, int square, int s2 = -1) {
-    if (square < 0 || square >= 64) return 0; // Invalid square
+// Direction of the pin on the piece on 'square', by the step from the piece towards its king:
+// 1 horizontal, 3 vertical, 2 towards the king on the east side diagonally, 4 on the west side.
+// Positive for white pieces, negative for black, 0 when not pinned.
+int pinned_direction(const Board& board, int square) {
+    int piece = board.get_piece(square);
+    if (piece == EMPTY) return 0;
 
-    int attack_count = 0;
-    int x = square % 8;
-    int y = square / 8;
+    bool white = piece < 6;
+    if (!(pinned_pieces(board, white) & (1ULL << square))) return 0;
 
-    // Define the four straight directions
-    const int rook_directions[4][2] = {
-            {1, 0}, {-1, 0}, {0, 1}, {0, -1}
-    };
+    int king = __builtin_ctzll(board.pieces[white ? WK : BK]);
+    int code = king / 8 == square / 8 ? 1 : king % 8 == square % 8 ? 3 : king % 8 > square % 8 ? 2 : 4;
+    return white ? code : -code;
+}
 
-    for (int i = 0; i < 4; ++i) {
-        int dx = rook_directions[i][0];
-        int dy = rook_directions[i][1];
-        int target_x = x + dx;
-        int target_y = y + dy;
+// Only white pieces count as pinned here, the evaluation terms see the board from white's side
+int pinned(const Board& board, int square) {
+    return (pinned_pieces(board, true) >> square) & 1;
+}
+
+// Helper function: Converts (x, y) to square index
+inline int xy_to_square(int x, int y) {
+    if (x < 0 || x > 7 || y < 0 || y > 7) return -1;
+    return y * 8 + x;
+}
 
-        while (target_x >= 0 && target_x < 8 && target_y >= 0 && target_y < 8) {
-            int target_square = xy_to_square(target_x, target_y);
-            if (target_square == -1) break;
+// Counts the number of attacks on 'square' by enemy knights
+int knight_attack(const Board& board, int square, int s2 = -1) {
+    if (square < 0 || square >= 64) return 0; // Invalid square
 
-            int piece = board.get_piece(target_square);
+    Bitboard attackers = KnightAttacks[square] & board.pieces[board.white_to_move ? BN : WN];
 
-            if (piece == EMPTY) {
-                // Continue scanning in this direction
-                target_x += dx;
-                target_y += dy;
-                continue;
-            }
+    // If 's2' is specified, skip other squares
+    if (s2 != -1) attackers &= 1ULL << s2;
 
-            // If 's2' is specified and doesn't match, skip
-            if (s2 != -1 && target_square != s2) break;
+    return popcount(attackers & ~pinned_pieces(board, true));
+}
 
-            bool is_enemy_rook_or_queen = board.white_to_move ?
-                                          (piece == BR || piece == BQ) :
-                                          (piece == WR || piece == WQ);
+// Counts the number of attacks on 'square' by enemy bishops (including x-ray through queens)
+int bishop_xray_attack(const Board& board, int square, int s2 = -1) {
+    if (square < 0 || square >= 64) return 0; // Invalid square
 
-            if (is_enemy_rook_or_queen && !pinned(board, target_square)) {
-                attack_count++;
-            }
+    // First blocker on each diagonal, restricted to enemy bishops and queens
+    Bitboard attackers = bishop_attacks(square, board.occupancy[2]) &
+                         (board.white_to_move ? board.pieces[BB] | board.pieces[BQ]
+                                              : board.pieces[WB] | board.pieces[WQ]);
 
-            break; // Blocked by any piece
-        }
-    }
+    // If 's2' is specified, skip other squares
+    if (s2 != -1) attackers &= 1ULL << s2;
 
-    return attack_count;
+    return popcount(attackers & ~pinned_pieces(board, true));
 }
 
-// Counts the number of attacks on 'square' by enemy queens
-int queen_attack(const Board& board, int square, int s2 = -1) {
+// Counts the number of attacks on 'square' by enemy rooks (including x-ray through queens)
+int rook_xray_attack(const Board& board, int square, int s2 = -1) {
     if (square < 0 || square >= 64) return 0; // Invalid square
 
-    int attack_count = 0;
-    int x = square % 8;
-    int y = square / 8;
-
-    // Define all eight directions (diagonal and straight)
-    const int queen_directions[8][2] = {
-            {1, 1}, {-1, 1}, {-1, -1}, {1, -1},
-            {1, 0}, {-1, 0}, {0, 1}, {0, -1}
-    };
+    // First blocker on each line, restricted to enemy rooks and queens
+    Bitboard attackers = rook_attacks(square, board.occupancy[2]) &
+                         (board.white_to_move ? board.pieces[BR] | board.pieces[BQ]
+                                              : board.pieces[WR] | board.pieces[WQ]);
 
-    for (int i = 0; i < 8; ++i) {
-        int dx = queen_directions[i][0];
-        int dy = queen_directions[i][1];
-        int target_x = x + dx;
-        int target_y = y + dy;
+    // If 's2' is specified, skip other squares
+    if (s2 != -1) attackers &= 1ULL << s2;
 
-        while (target_x >= 0 && target_x < 8 && target_y >= 0 && target_y < 8) {
-            int target_square = xy_to_square(target_x, target_y);
-            if (target_square == -1) break;
+    return popcount(attackers & ~pinned_pieces(board, true));
+}
 
-            int piece = board.get_piece(target_square);
+// Counts the number of attacks on 'square' by enemy queens
+int queen_attack(const Board& board, int square, int s2 = -1) {
+    if (square < 0 || square >= 64) return 0; // Invalid square
 
-            if (piece == EMPTY) {
-                // Continue scanning in this direction
-                target_x += dx;
-                target_y += dy;
-                continue;
-            }
+    Bitboard attackers = queen_attacks(square, board.occupancy[2]) &
+                         (board.white_to_move ? board.pieces[BQ] : board.pieces[WQ]);
 
-            // If 's2' is specified and doesn't match, skip
-            if (s2 != -1 && target_square != s2) break;
+    // If 's2' is specified, skip other squares
+    if (s2 != -1) attackers &= 1ULL << s2;
 
-            bool is_enemy_queen = board.white_to_move ?
-                                  (piece == BQ) :
-                                  (piece == WQ);
+    return popcount(attackers & ~pinned_pieces(board, true));
+}
 
-            if (is_enemy_queen && !pinned(board, target_square)) {
-                attack_count++;
+// Attack planes of both sides, built in one pass over the pieces so evaluation terms can read
+// them instead of asking the helpers above square by square. Definitions match the helpers:
+// sliders stop at the first piece, bishop and rook counts include queens on their lines, and
+// pinned knights, bishops, rooks and queens are left out, where only white pieces count as pinned.
+struct AttackInfo {
+    Bitboard attacked_by[6][2];  // By piece type (pawn to king) and colour (0 white, 1 black)
+    Bitboard attacked[2];        // By any piece of the colour
+    Bitboard attacked_twice[2];  // By at least two pieces of the colour
+    uint8_t knight_count[2][64]; // knight_attack
+    uint8_t bishop_count[2][64]; // bishop_xray_attack, bishops and queens
+    uint8_t rook_count[2][64];   // rook_xray_attack, rooks and queens
+    uint8_t queen_count[2][64];  // queen_attack
+
+    explicit AttackInfo(const Board &board) {
+        std::memset(this, 0, sizeof(*this));
+        Bitboard pinned = pinned_pieces(board, true);
+
+        for (int color = 0; color < 2; ++color) {
+            int offset = color * 6;
+
+            // Pawns one capture direction at a time, so a square hit by two pawns counts twice
+            Bitboard pawns = board.pieces[WP + offset];
+            Bitboard west = color == 0 ? (pawns & ~FILE_A) << 7 : (pawns & ~FILE_A) >> 9;
+            Bitboard east = color == 0 ? (pawns & ~FILE_H) << 9 : (pawns & ~FILE_H) >> 7;
+            add(PAWN_TYPE, color, west);
+            add(PAWN_TYPE, color, east);
+
+            if (board.pieces[WK + offset]) add(KING_TYPE, color, KingAttacks[__builtin_ctzll(board.pieces[WK + offset])]);
+
+            for (int type = WN; type <= WQ; ++type) {
+                Bitboard pieces = board.pieces[type + offset] & ~pinned;
+                while (pieces) {
+                    int from = pop_lsb(pieces);
+                    Bitboard bishop = type == WB || type == WQ ? bishop_attacks(from, board.occupancy[2]) : 0;
+                    Bitboard rook = type == WR || type == WQ ? rook_attacks(from, board.occupancy[2]) : 0;
+                    Bitboard attacks = type == WN ? KnightAttacks[from] : bishop | rook;
+                    add(type, color, attacks);
+
+                    count(type == WN ? knight_count[color] : type == WQ ? queen_count[color] : nullptr, attacks);
+                    count(bishop_count[color], bishop);
+                    count(rook_count[color], rook);
+                }
             }
-
-            break; // Blocked by any piece
         }
     }
 
-    return attack_count;
-}
+private:
+    static constexpr int PAWN_TYPE = 0;
+    static constexpr int KING_TYPE = 5;
+
+    void add(int type, int color, Bitboard attacks) {
+        attacked_by[type][color] |= attacks;
+        attacked_twice[color] |= attacked[color] & attacks;
+        attacked[color] |= attacks;
+    }
+
+    static void count(uint8_t *counts, Bitboard attacks) {
+        if (!counts) return;
+        while (attacks) counts[pop_lsb(attacks)]++;
+    }
+};
 
 // Counts the rank of a given square or sums ranks for all squares if square == -1
 int rank(const Board& board, int square = -1) {
@@ -630,576 +1179,1986 @@ int blockers_for_king(const Board& board, int square = -1) {
     int flipped_square = xy_to_square(x, 7 - y);
 
     // Check if the piece at flipped_square is pinned
-    if (flipped.pinned(flipped, flipped_square)) {
+    if (pinned(flipped, flipped_square)) {
         return 1;
     }
 
     return 0;
 }
 
-// Determines if a square is within the mobility area
+// Squares that count towards mobility, all at once: everything except squares holding a king or
+// queen, squares attacked by enemy pawns, own pawns on ranks 6-8 (y >= 5) or blocked from behind,
+// and pieces pinned to the king ('blockers_for_king'). Follows the helpers' conventions: enemy pawns
+// attack along PawnAttacks[0] and 'blocked' looks one square towards rank 1 when white is to move.
+Bitboard mobility_area_mask(const Board& board) {
+    Bitboard enemy_pawns = board.pieces[board.white_to_move ? BP : WP];
+    Bitboard pawn_attacked = ((enemy_pawns & ~FILE_A) << 7) | ((enemy_pawns & ~FILE_H) << 9);
+
+    Bitboard pawns = board.pieces[WP] | board.pieces[BP];
+    Bitboard blocked = board.white_to_move ? board.occupancy[2] << 8 : board.occupancy[2] >> 8;
+    Bitboard excluded_pawns = pawns & (~((1ULL << 40) - 1) | blocked);
+
+    Bitboard kings_queens = board.pieces[WK] | board.pieces[BK] | board.pieces[WQ] | board.pieces[BQ];
+    return ~(kings_queens | pawn_attacked | excluded_pawns | pinned_pieces(board, true));
+}
+
+// Determines if a square is within the mobility area, or counts the area if square == -1
 // Returns 1 if in mobility area, 0 otherwise
 int mobility_area(const Board& board, int square = -1) {
-    if (square == -1) {
-        int total_mobility = 0;
-        for(int sq = 0; sq < 64; ++sq){
-            total_mobility += mobility_area(board, sq);
-        }
-        return total_mobility;
-    }
-
+    if (square == -1) return popcount(mobility_area_mask(board));
     if (square < 0 || square >= 64) return 0; // Invalid square
+    return (mobility_area_mask(board) >> square) & 1;
+}
 
-    // Get (x, y) coordinates
-    int x = square % 8;
-    int y = square / 8;
-
-    // Piece at the square
+// Mobility of the piece on 'square' given the mobility area: its attacks into the area, with
+// queens excluded as knight and bishop targets. As in knight_attack and the x-ray helpers, only
+// unpinned pieces of the side not to move are counted.
+int piece_mobility(const Board& board, int square, Bitboard area) {
     int piece = board.get_piece(square);
-
-    // If the piece is King or Queen, exclude from mobility area
-    if (piece == WK || piece == BK || piece == WQ || piece == BQ) {
-        return 0;
-    }
-
-    // Check for enemy pawns protecting the square
-    // Assuming white_to_move indicates the side to move, so enemy pawns are black pawns if white_to_move is true
-    bool is_white_to_move = board.white_to_move;
-    // Enemy pawns attack diagonally forward
-    int enemy_pawn1 = is_white_to_move ? BP : WP;
-    int enemy_pawn2 = is_white_to_move ? BP : WP;
-
-    // Positions of enemy pawns that can attack this square
-    int pawn_attack1 = xy_to_square(x - 1, y - 1);
-    int pawn_attack2 = xy_to_square(x + 1, y - 1);
-
-    if (pawn_attack1 != -1 && board.get_piece(pawn_attack1) == enemy_pawn1) return 0;
-    if (pawn_attack2 != -1 && board.get_piece(pawn_attack2) == enemy_pawn2) return 0;
-
-    // Check if the piece is a Pawn and handle mobility area exclusions
-    if (piece == WP || piece == BP) {
-        // Get rank of the pawn
-        int pawn_rank = rank(board, square);
-        // Pawns on ranks 2 and 3 (for white pawns, or 7 and 6 for black pawns)
-        if (is_white_to_move) {
-            if (pawn_rank < 4) return 0; // White pawns on ranks 1-3
-            // Check if the pawn is blocked by another piece
-            int behind_square = xy_to_square(x, y - 1);
-            if (behind_square != -1 && board.get_piece(behind_square) != EMPTY) return 0;
-        }
-        else {
-            if (pawn_rank < 4) return 0; // Black pawns on ranks 1-3
-            // Check if the pawn is blocked by another piece
-            int behind_square = xy_to_square(x, y + 1);
-            if (behind_square != -1 && board.get_piece(behind_square) != EMPTY) return 0;
-        }
-    }
-
-    // Check for blockers for the king
-    // Assuming the square corresponds to a piece that could block the king
-    // Use colorflip to analyze from opponent's perspective
-    Board flipped = colorflip(board);
-    int flipped_square = xy_to_square(x, 7 - (y));
-    if (blockers_for_king(flipped, flipped_square)) {
-        return 0;
+    int enemy = board.white_to_move ? 6 : 0;
+    if (piece == EMPTY || piece < WN + enemy || piece > WQ + enemy) return 0;
+    if (pinned_pieces(board, true) & (1ULL << square)) return 0;
+
+    Bitboard queens = board.pieces[WQ] | board.pieces[BQ];
+    switch (piece - enemy) {
+        case WN:
+            return popcount(KnightAttacks[square] & area & ~queens);
+        case WB:
+            return popcount(bishop_attacks(square, board.occupancy[2]) & area & ~queens);
+        case WR:
+            return popcount(rook_attacks(square, board.occupancy[2]) & area);
+        default:
+            return popcount(queen_attacks(square, board.occupancy[2]) & area);
     }
-
-    // All conditions passed; the square is within the mobility area
-    return 1;
 }
 
 // Counts the mobility of a piece at a given square or sums for all squares if square == -1
 int mobility(const Board& board, int square = -1) {
+    Bitboard area = mobility_area_mask(board);
     if (square == -1) {
         int total_mobility = 0;
-        for(int sq = 0; sq < 64; ++sq){
-            total_mobility += mobility(board, sq);
-        }
+        Bitboard pieces = board.occupancy[2];
+        while (pieces) total_mobility += piece_mobility(board, pop_lsb(pieces), area);
         return total_mobility;
     }
 
     if (square < 0 || square >= 64) return 0; // Invalid square
+    return piece_mobility(board, square, area);
+}
 
-    // Get the piece at the square
-    int piece = board.get_piece(square);
-
-    // Check if the piece is one of N, B, R, Q
-    if (piece != WN && piece != BN && piece != WB && piece != BB &&
-        piece != WR && piece != BR && piece != WQ && piece != BQ) {
-        return 0;
-    }
-
-    int mobility_count = 0;
-
-    // Iterate through all squares on the board
-    for(int x = 0; x < 8; ++x){
-        for(int y = 0; y < 8; ++y){
-            int target_square = xy_to_square(x, y);
-            if(target_square == -1) continue;
-
-            // Check if the target square is within the mobility area
-            if(!mobility_area(board, target_square)) continue;
+// Bonus for a knight (0), bishop (1), rook (2) or queen (3) with 'count' moves
+int mobility_bonus_value(int type, int count, bool mg) {
+    static const std::vector<std::vector<int>> mg_bonus = {
+            {-62, -53, -12, -4, 3, 13, 22, 28, 33},                            // Knight
+            {-48, -20, 16, 26, 38, 51, 55, 63, 63, 68, 81, 81, 91, 98},      // Bishop
+            {-60, -20, 2, 3, 3, 11, 22, 31, 40, 40, 41, 48, 57, 57, 62},     // Rook
+            {-30, -12, -8, -9, 20, 23, 23, 35, 38, 53, 64, 65, 65, 66, 67, 67, 72, 72, 77, 79, 93, 108, 108, 108, 110, 114, 114, 116} // Queen
+    };
 
-            // Depending on the piece type, check attacks
-            if(piece == WN || piece == BN){
-                // Knight attack
-                if(knight_attack(board, target_square, square) && board.get_piece(target_square) != WQ && board.get_piece(target_square) != BQ){
-                    mobility_count++;
-                }
-            }
-            else if(piece == WB || piece == BB){
-                // Bishop x-ray attack
-                if(bishop_xray_attack(board, target_square, square) && board.get_piece(target_square) != WQ && board.get_piece(target_square) != BQ){
-                    mobility_count++;
-                }
-            }
-            else if(piece == WR || piece == BR){
-                // Rook x-ray attack
-                if(rook_xray_attack(board, target_square, square)){
-                    mobility_count++;
-                }
-            }
-            else if(piece == WQ || piece == BQ){
-                // Queen attack
-                if(queen_attack(board, target_square, square)){
-                    mobility_count++;
-                }
-            }
-        }
-    }
+    static const std::vector<std::vector<int>> eg_bonus = {
+            {-81, -56, -31, -16, 5, 11, 17, 20, 25},                                 // Knight
+            {-59, -23, -3, 13, 24, 42, 54, 57, 65, 73, 78, 86, 88, 97},              // Bishop
+            {-78, -17, 23, 39, 70, 99, 103, 121, 134, 139, 158, 164, 168, 169, 172}, // Rook
+            {-48, -30, -7, 19, 40, 55, 59, 75, 78, 96, 96, 100, 121, 127, 131, 133, 136, 141, 147, 150, 151, 168, 168, 171, 182, 182, 192, 219} // Queen
+    };
 
-    return mobility_count;
+    const std::vector<int> &table = (mg ? mg_bonus : eg_bonus)[type];
+    return table[std::max(0, std::min(count, int(table.size()) - 1))];
 }
 
-// Assigns mobility bonuses based on piece type and mobility count
+// Assigns mobility bonuses based on piece type and mobility count, summed over every knight,
+// bishop, rook and queen if square == -1
 int mobility_bonus(const Board& board, int square = -1, bool mg = true) {
+    Bitboard area = mobility_area_mask(board);
     if (square == -1) {
         int total_bonus = 0;
-        for(int sq = 0; sq < 64; ++sq){
-            total_bonus += mobility_bonus(board, sq, mg);
+        for (int type = WN; type <= WQ; ++type) {
+            Bitboard pieces = board.pieces[type] | board.pieces[type + 6];
+            while (pieces) {
+                total_bonus += mobility_bonus_value(type - WN, piece_mobility(board, pop_lsb(pieces), area), mg);
+            }
         }
         return total_bonus;
     }
 
     if (square < 0 || square >= 64) return 0; // Invalid square
 
-    // Get the piece at the square
+    // Only knights, bishops, rooks and queens get a bonus
     int piece = board.get_piece(square);
+    if (piece == EMPTY || piece % 6 < WN || piece % 6 > WQ) return 0;
 
-    // Check if the piece is one of N, B, R, Q
-    if (piece != WN && piece != BN && piece != WB && piece != BB &&
-        piece != WR && piece != BR && piece != WQ && piece != BQ) {
-        return 0;
-    }
+    return mobility_bonus_value(piece % 6 - WN, piece_mobility(board, square, area), mg);
+}
 
-    // Define the bonus tables for middlegame and endgame
-    const std::vector<std::vector<int>> mg_bonus = {
-            {-62, -53, -12, -4, 3, 13, 22, 28, 33},                            // Knight
-            {-48, -20, 16, 26, 38, 51, 55, 63, 63, 68, 81, 81, 91, 98},      // Bishop
-            {-60, -20, 2, 3, 3, 11, 22, 31, 40, 40, 41, 48, 57, 57, 62},     // Rook
-            {-30, -12, -8, -9, 20, 23, 23, 35, 38, 53, 64, 65, 65, 66, 67, 67, 72, 72, 77, 79, 93, 108, 108, 108, 110, 114, 114, 116} // Queen
-    };
 
-    const std::vector<std::vector<int>> eg_bonus = {
-            {-81, -56, -31, -16, 5, 11, 17, 20, 25},                                 // Knight
-            {-59, -23, -3, 13, 24, 42, 54, 57, 65, 73, 78, 86, 88, 97},              // Bishop
-            {-78, -17, 23, 39, 70, 99, 103, 121, 134, 139, 158, 164, 168, 169, 172}, // Rook
-            {-48, -30, -7, 19, 40, 55, 59, 75, 78, 96, 96, 100, 121, 127, 131, 133, 136, 141, 147, 150, 151, 168, 168, 171, 182, 182, 192, 219} // Queen
-    };
 
-    // Determine the index for the bonus table based on piece type
-    int bonus_index = -1;
-    if(piece == WN || piece == BN){
-        bonus_index = 0; // Knight
-    }
-    else if(piece == WB || piece == BB){
-        bonus_index = 1; // Bishop
-    }
-    else if(piece == WR || piece == BR){
-        bonus_index = 2; // Rook
+// Pawn structure terms of the Stockfish evaluation guide, {mg, eg}
+constexpr Score ISOLATED = make_score(5, 15);
+constexpr Score BACKWARD = make_score(9, 24);
+constexpr Score DOUBLED = make_score(11, 56);
+constexpr int connected_seed[7] = {0, 7, 8, 12, 29, 48, 86}; // By relative rank, rank 2 is 1
+constexpr int passed_rank_mg[7] = {0, 10, 17, 15, 62, 168, 276};
+constexpr int passed_rank_eg[7] = {0, 28, 33, 41, 72, 177, 260};
+
+// Everything that depends on the pawns alone, cached by pawn key
+struct PawnEntry {
+    uint64_t key;
+    Score score;              // White's view
+    Bitboard passed[2];       // Passed pawns, White and Black
+    Bitboard attack_span[2];  // Union of PawnAttackSpan over each side's pawns
+};
+
+// Pawn structure score of one side, filling in its passed pawns and attack span
+Score evaluate_pawns(const Board &board, int us, PawnEntry &entry) {
+    int them = us ^ 1;
+    Bitboard ours = board.pieces[us == 0 ? WP : BP];
+    Bitboard theirs = board.pieces[us == 0 ? BP : WP];
+    int push = us == 0 ? 8 : -8;
+    Score score = 0;
+
+    Bitboard bb = ours;
+    while (bb) {
+        int sq = pop_lsb(bb);
+        int file = sq % 8;
+        int r = us == 0 ? sq / 8 : 7 - sq / 8; // Relative rank, 0 to 7
+        Bitboard adjacent = adjacent_files(file);
+
+        Bitboard opposed = theirs & ForwardFileBB[us][sq];
+        Bitboard stoppers = theirs & PassedPawnMask[us][sq];
+        Bitboard support = ours & PawnAttacks[them][sq];
+        Bitboard phalanx = ours & adjacent & (RANK_1 << (sq & 56));
+        Bitboard behind = ours & PawnAttackSpan[them][sq]; // Own pawns on adjacent files further back
+
+        entry.attack_span[us] |= PawnAttackSpan[us][sq];
+
+        bool isolated = !(ours & adjacent);
+        // Cannot be guarded by a pawn from the side or behind, and the stop square is unsafe
+        bool backward = !isolated && !(behind | phalanx) &&
+                        (theirs & (PawnAttacks[us][sq + push] | 1ULL << (sq + push)));
+        bool doubled = (ours >> (sq - push) & 1) && !support;
+
+        if (isolated) score -= ISOLATED;
+        else if (backward) score -= BACKWARD;
+        if (doubled) score -= DOUBLED;
+
+        if (support | phalanx) {
+            int v = connected_seed[r] * (2 + bool(phalanx) - bool(opposed)) + 21 * popcount(support);
+            score += make_score(v, v * (r - 2) / 4);
+        }
+
+        // The frontmost pawn on its file, with no enemy pawn in front or able to capture it
+        if (!stoppers && !(ours & ForwardFileBB[us][sq])) {
+            entry.passed[us] |= 1ULL << sq;
+            score += make_score(passed_rank_mg[r], passed_rank_eg[r]);
+        }
     }
-    else if(piece == WQ || piece == BQ){
-        bonus_index = 3; // Queen
+    return score;
+}
+
+// Pawn hash table, one per search thread and kept from one search to the next in its SearchInfo.
+// Pawns rarely move in search, so nearly every probe hits.
+class PawnTable {
+    static constexpr size_t SIZE = 8192;
+    PawnEntry entries[SIZE] = {}; // The zeroed entry is exact for the position without pawns
+
+public:
+    PawnEntry &probe(const Board &board) {
+        PawnEntry &entry = entries[board.pawn_key & (SIZE - 1)];
+        if (entry.key == board.pawn_key) return entry;
+        entry.key = board.pawn_key;
+        entry.passed[0] = entry.passed[1] = entry.attack_span[0] = entry.attack_span[1] = 0;
+        entry.score = evaluate_pawns(board, 0, entry) - evaluate_pawns(board, 1, entry);
+        return entry;
     }
+};
+
+// 0 in a bare endgame up to PHASE_MIDGAME with most of the pieces still on
+inline int game_phase(const Board &board) {
+    int npm = std::clamp(board.non_pawn_material, ENDGAME_LIMIT, MIDGAME_LIMIT);
+    return (npm - ENDGAME_LIMIT) * PHASE_MIDGAME / (MIDGAME_LIMIT - ENDGAME_LIMIT);
+}
+
+int evaluate(const Board &board, PawnTable &pawns) {
+    // MATERIAL and PIECE LOCATION, both phases, kept up to date by the board
+    Score score = board.psq;
+#ifdef DEBUG_EVAL // Build with -DDEBUG_EVAL to check the accumulator against a full recompute
+    Board fresh = board;
+    fresh.compute_keys();
+    assert(fresh.psq == score);
+#endif
+
+    // PAWN STRUCTURE
+    score += pawns.probe(board).score;
+
+    int phase = game_phase(board);
+    int value = (mg_value(score) * phase + eg_value(score) * (PHASE_MIDGAME - phase)) / PHASE_MIDGAME;
+    return board.white_to_move ? value : -value;
+}
 
-    if(bonus_index == -1) return 0; // Should not happen
+// Move generation
+// Which moves to generate. Captures include every promotion, quiets are the rest,
+// evasions are all moves when in check. Every generator only returns legal moves.
+enum GenType {
+    GEN_CAPTURES,
+    GEN_QUIETS,
+    GEN_EVASIONS,
+    GEN_ALL
+};
 
-    // Get mobility count for the piece
-    int mobility_count = mobility(board, square);
+// Checkers and pins of the side to move, worked out once per node
+struct CheckInfo {
+    int king;
+    Bitboard checkers;
+    Bitboard check_mask; // Where non-king moves may land: anywhere, onto or in front of a single checker,
+                         // nowhere in double check
+    Bitboard pinned;     // Own pieces pinned to the king, they may only move along the pin
+
+    template<SliderBackend B>
+    static CheckInfo compute(const Board &board) {
+        CheckInfo ci;
+        bool white = board.white_to_move;
+        Bitboard enemy = white ? board.occupancy[1] : board.occupancy[0];
+
+        ci.king = __builtin_ctzll(board.pieces[white ? WK : BK]);
+        ci.checkers = attackers_to<B>(board, ci.king, board.occupancy[2]) & enemy;
+        ci.check_mask = !ci.checkers ? ~0ULL
+                      : ci.checkers & (ci.checkers - 1) ? 0
+                      : ci.checkers | BetweenBB[ci.king][__builtin_ctzll(ci.checkers)];
+        ci.pinned = pinned_pieces<B>(board, white);
+        return ci;
+    }
 
-    // Select the appropriate bonus table
-    const std::vector<std::vector<int>>* bonus_table = mg ? &mg_bonus : &eg_bonus;
+    explicit CheckInfo(const Board &board) {
+        *this = slider_backend == PEXT_BACKEND ? compute<PEXT_BACKEND>(board) : compute<MAGIC_BACKEND>(board);
+    }
 
-    // Ensure mobility_count is within the bonus table range
-    if(mobility_count < 0){
-        mobility_count = 0;
+    // Squares the non-king piece on 'from' may legally move to
+    Bitboard allowed(int from) const {
+        return pinned & (1ULL << from) ? check_mask & LineBB[king][from] : check_mask;
     }
-    else if(mobility_count >= (*bonus_table)[bonus_index].size()){
-        mobility_count = (*bonus_table)[bonus_index].size() - 1;
+
+private:
+    CheckInfo() = default;
+};
+
+struct MoveGenerator {
+    static void generate_moves(const Board &board, MoveList &moves) {
+        generate(board, moves, GEN_ALL, CheckInfo(board));
     }
 
-    // Retrieve and return the bonus
-    return (*bonus_table)[bonus_index][mobility_count];
-}
+    static void generate_captures(const Board &board, MoveList &moves) {
+        generate(board, moves, GEN_CAPTURES, CheckInfo(board));
+    }
 
+    static void generate_quiets(const Board &board, MoveList &moves) {
+        generate(board, moves, GEN_QUIETS, CheckInfo(board));
+    }
 
+    static void generate_evasions(const Board &board, MoveList &moves) {
+        generate(board, moves, GEN_EVASIONS, CheckInfo(board));
+    }
 
-int evaluate(const Board &board) {
-    int score = 0;
+    static void generate(const Board &board, MoveList &moves, GenType type, const CheckInfo &ci) {
+        if (slider_backend == PEXT_BACKEND) generate<PEXT_BACKEND>(board, moves, type, ci);
+        else generate<MAGIC_BACKEND>(board, moves, type, ci);
+    }
 
-    // Evaluates MATERIAL and PIECE LOCATION
-    for (int p = 0; p < 12; p++) {
-        Bitboard bb = board.pieces[p];
-        while (bb) {
-            int sq = pop_lsb(bb);
-            if (p == 5 || p == 11) continue;
-            if (p < 6) {
-                score += piece_value[0][p];
-                if (p == 0) score += pawn_psqt[0][sq / 8][sq % 8];
-                else score += psqt[0][p - 1][sq / 8][std::min(sq % 8, 7 - sq % 8)];
-            } else {
-                sq = 63 - sq;
-                score -= piece_value[0][p - 6];
-                if (p == 6) score -= pawn_psqt[0][sq / 8][sq % 8];
-                else score -= psqt[0][p - 7][sq / 8][std::min(sq % 8, 7 - sq % 8)];
-            }
+    template<SliderBackend B>
+    static void generate(const Board &board, MoveList &moves, GenType type, const CheckInfo &ci) {
+        bool white = board.white_to_move;
+        Bitboard own = white ? board.occupancy[0] : board.occupancy[1];
+        Bitboard enemy = white ? board.occupancy[1] : board.occupancy[0];
+        Bitboard empty = ~board.occupancy[2];
+
+        // Target squares by kind, further limited per piece by the check mask and pins
+        Bitboard targets = type == GEN_CAPTURES ? enemy : type == GEN_QUIETS ? empty : ~own;
+
+        generate_king_moves<B>(board, moves, white, targets);
+        if (ci.checkers & (ci.checkers - 1)) return; // Double check, only the king may move
+
+        generate_pawn_moves<B>(board, moves, white, type, ci);
+        generate_knight_moves(board, moves, white, targets, ci);
+        generate_bishop_moves<B>(board, moves, white, targets, ci);
+        generate_rook_moves<B>(board, moves, white, targets, ci);
+        generate_queen_moves<B>(board, moves, white, targets, ci);
+        if ((type == GEN_QUIETS || type == GEN_ALL) && !ci.checkers) {
+            generate_castling_moves<B>(board, moves);
         }
     }
 
-    return board.white_to_move ? score : -score;
-}
+    static void add_promotions(MoveList &moves, int from, int to) {
+        moves.emplace_back(from, to, PROMO_Q);
+        moves.emplace_back(from, to, PROMO_R);
+        moves.emplace_back(from, to, PROMO_B);
+        moves.emplace_back(from, to, PROMO_N);
+    }
 
-// Move generation
-struct MoveGenerator {
-    static void generate_moves(const Board &board, std::vector<Move> &moves) {
-        if (board.white_to_move) {
-            generate_pawn_moves(board, moves, true);
-            generate_knight_moves(board, moves, true);
-            generate_bishop_moves(board, moves, true);
-            generate_rook_moves(board, moves, true);
-            generate_queen_moves(board, moves, true);
-            generate_king_moves(board, moves, true);
-        } else {
-            generate_pawn_moves(board, moves, false);
-            generate_knight_moves(board, moves, false);
-            generate_bishop_moves(board, moves, false);
-            generate_rook_moves(board, moves, false);
-            generate_queen_moves(board, moves, false);
-            generate_king_moves(board, moves, false);
-        }
-        generate_castling_moves(board, moves);
+    // Whether the square 'square' is attacked by the side not to move, given the occupancy
+    template<SliderBackend B>
+    static bool attacked(const Board &board, int square, Bitboard occupied) {
+        Bitboard enemy = board.white_to_move ? board.occupancy[1] : board.occupancy[0];
+        return attackers_to<B>(board, square, occupied) & enemy;
     }
 
-    static void generate_pawn_moves(const Board &board, std::vector<Move> &moves, bool white) {
+    // En passant removes two pawns from a rank or diagonal at once, so pins are checked by
+    // recomputing slider attacks on the king with both gone
+    template<SliderBackend B>
+    static bool en_passant_legal(const Board &board, int from, int to, const CheckInfo &ci) {
+        int captured = to + (board.white_to_move ? -8 : 8);
+        if (!(ci.check_mask & ((1ULL << to) | (1ULL << captured)))) return false;
+
+        int them = board.white_to_move ? 6 : 0;
+        Bitboard occupied = (board.occupancy[2] ^ (1ULL << from) ^ (1ULL << captured)) | (1ULL << to);
+        return !(rook_attacks<B>(ci.king, occupied) & (board.pieces[WR + them] | board.pieces[WQ + them])) &&
+               !(bishop_attacks<B>(ci.king, occupied) & (board.pieces[WB + them] | board.pieces[WQ + them]));
+    }
+
+    template<SliderBackend B>
+    static void generate_pawn_moves(const Board &board, MoveList &moves, bool white, GenType type, const CheckInfo &ci) {
         Bitboard pawns = white ? board.pieces[WP] : board.pieces[BP];
-        Bitboard empty = ~(board.occupancy[0] | board.occupancy[1]);
+        Bitboard enemy = white ? board.occupancy[1] : board.occupancy[0];
+        Bitboard empty = ~board.occupancy[2];
+        int up = white ? 8 : -8;
+        int last_rank = white ? 7 : 0;
+        int start_rank = white ? 1 : 6;
+        bool noisy = type != GEN_QUIETS;
+        bool quiet = type != GEN_CAPTURES;
+
         while (pawns) {
             int from = pop_lsb(pawns);
-            if (white) {
-                if (from < 56 && empty & (1ULL << (from + 8))) {
-                    // Move forward
-                    if ((from + 8) / 8 == 7) {
-                        // Promotions
-                        moves.emplace_back(from, from + 8, WQ);
-                        moves.emplace_back(from, from + 8, WR);
-                        moves.emplace_back(from, from + 8, WB);
-                        moves.emplace_back(from, from + 8, WN);
-                    } else {
-                        moves.emplace_back(from, from + 8);
-                        // Double move
-                        if (from >= 8 && from <= 15 && (empty & (1ULL << (from + 16)))) {
-                            moves.emplace_back(from, from + 16);
-                        }
-                    }
-                }
-                // Captures
-                if ((from % 8) != 0 && (board.occupancy[1] & (1ULL << (from + 7)))) {
-                    if (from + 7 < 64) {
-                        if ((from + 7) / 8 == 7) {
-                            moves.emplace_back(from, from + 7, WQ);
-                            moves.emplace_back(from, from + 7, WR);
-                            moves.emplace_back(from, from + 7, WB);
-                            moves.emplace_back(from, from + 7, WN);
-                        } else {
-                            moves.emplace_back(from, from + 7);
-                        }
-                    }
-                }
-                if ((from % 8) != 7 && (board.occupancy[1] & (1ULL << (from + 9)))) {
-                    if (from + 9 < 64) {
-                        if ((from + 9) / 8 == 7) {
-                            moves.emplace_back(from, from + 9, WQ);
-                            moves.emplace_back(from, from + 9, WR);
-                            moves.emplace_back(from, from + 9, WB);
-                            moves.emplace_back(from, from + 9, WN);
-                        } else {
-                            moves.emplace_back(from, from + 9);
-                        }
-                    }
-                }
-                // En passant
-                if (board.en_passant != -1) {
-                    if (abs(board.en_passant - from) == 7 || abs(board.en_passant - from) == 9) {
-                        moves.emplace_back(from, board.en_passant);
-                    }
-                }
-            } else {
-                if (from > 7 && empty & (1ULL << (from - 8))) {
-                    // Move forward
-                    if ((from - 8) / 8 == 0) {
-                        // Promotions
-                        moves.emplace_back(from, from - 8, BQ);
-                        moves.emplace_back(from, from - 8, BR);
-                        moves.emplace_back(from, from - 8, BB);
-                        moves.emplace_back(from, from - 8, BN);
-                    } else {
-                        moves.emplace_back(from, from - 8);
-                        // Double move
-                        if (from >= 48 && from <= 55 && (empty & (1ULL << (from - 16)))) {
-                            moves.emplace_back(from, from - 16);
-                        }
-                    }
-                }
-                // Captures
-                if ((from % 8) != 0 && (board.occupancy[0] & (1ULL << (from - 9)))) {
-                    if (from - 9 >= 0) {
-                        if ((from - 9) / 8 == 0) {
-                            moves.emplace_back(from, from - 9, BQ);
-                            moves.emplace_back(from, from - 9, BR);
-                            moves.emplace_back(from, from - 9, BB);
-                            moves.emplace_back(from, from - 9, BN);
-                        } else {
-                            moves.emplace_back(from, from - 9);
-                        }
-                    }
-                }
-                if ((from % 8) != 7 && (board.occupancy[0] & (1ULL << (from - 7)))) {
-                    if (from - 7 >= 0) {
-                        if ((from - 7) / 8 == 0) {
-                            moves.emplace_back(from, from - 7, BQ);
-                            moves.emplace_back(from, from - 7, BR);
-                            moves.emplace_back(from, from - 7, BB);
-                            moves.emplace_back(from, from - 7, BN);
-                        } else {
-                            moves.emplace_back(from, from - 7);
-                        }
+            int to = from + up;
+            bool promotion = to / 8 == last_rank;
+            Bitboard allowed = ci.allowed(from);
+
+            // Move forward
+            if (empty & (1ULL << to)) {
+                if (promotion) {
+                    if (noisy && (allowed & (1ULL << to))) add_promotions(moves, from, to);
+                } else if (quiet) {
+                    if (allowed & (1ULL << to)) moves.emplace_back(from, to);
+                    // Double move
+                    int double_to = to + up;
+                    if (from / 8 == start_rank && (empty & (1ULL << double_to)) && (allowed & (1ULL << double_to))) {
+                        moves.emplace_back(from, double_to, DOUBLE_PUSH);
                     }
                 }
-                // En passant
-                if (board.en_passant != -1) {
-                    if (abs(board.en_passant - from) == 7 || abs(board.en_passant - from) == 9) {
-                        moves.emplace_back(from, board.en_passant);
-                    }
+            }
+            if (!noisy) continue;
+
+            // Captures
+            Bitboard captures = PawnAttacks[white ? 0 : 1][from] & enemy & allowed;
+            while (captures) {
+                int target = pop_lsb(captures);
+                if (promotion) {
+                    add_promotions(moves, from, target);
+                } else {
+                    moves.emplace_back(from, target);
                 }
             }
+            // En passant
+            if (board.en_passant != -1 && (PawnAttacks[white ? 0 : 1][from] & (1ULL << board.en_passant)) &&
+                en_passant_legal<B>(board, from, board.en_passant, ci)) {
+                moves.emplace_back(from, board.en_passant, EN_PASSANT);
+            }
         }
     }
 
-    static void generate_knight_moves(const Board &board, std::vector<Move> &moves, bool white) {
-        Bitboard knights = white ? board.pieces[WN] : board.pieces[BN];
-        Bitboard own = white ? board.occupancy[0] : board.occupancy[1];
+    static void generate_knight_moves(const Board &board, MoveList &moves, bool white, Bitboard targets,
+                                      const CheckInfo &ci) {
+        Bitboard knights = (white ? board.pieces[WN] : board.pieces[BN]) & ~ci.pinned; // A pinned knight never moves
         while (knights) {
             int from = pop_lsb(knights);
-            const int knight_offsets[8] = {17, 15, 10, 6, -17, -15, -10, -6};
-            for (auto offset: knight_offsets) {
-                int to = from + offset;
-                if (to < 0 || to >= 64) continue;
-                // Handle wrapping
-                if (abs(to % 8 - from % 8) > 2) continue;
-                if (!(own & (1ULL << to))) {
-                    moves.emplace_back(from, to);
-                }
+            Bitboard attacks = KnightAttacks[from] & targets & ci.check_mask;
+            while (attacks) {
+                moves.emplace_back(from, pop_lsb(attacks));
             }
         }
     }
 
-// Modified generate_slider_moves
-    static void
-    generate_slider_moves(const Board &board, std::vector<Move> &moves, bool white, int piece, const int *dirs,
-                          int dir_count) {
+    // Generates bishop, rook or queen moves ('piece' given as the white piece type) via table lookup
+    template<SliderBackend B>
+    static void generate_slider_moves(const Board &board, MoveList &moves, bool white, int piece, Bitboard targets,
+                                      const CheckInfo &ci) {
         Bitboard sliders = white ? board.pieces[piece] : board.pieces[piece + 6];
-        Bitboard own = white ? board.occupancy[0] : board.occupancy[1];
 
         while (sliders) {
             int from = pop_lsb(sliders);
-            for (int d = 0; d < dir_count; ++d) {
-                int to = from;
-                while (true) {
-                    to += dirs[d];
-                    if (to < 0 || to >= 64) break; // Off-board
-
-                    // Handle wrapping for diagonal moves
-                    if (dirs[d] == -9 || dirs[d] == -7 || dirs[d] == 7 || dirs[d] == 9) {
-                        if (to % 8 == 0 || to % 8 == 7) break; // Prevent wrapping
-                    }
-
-                    if (own & (1ULL << to)) break;
-                    moves.emplace_back(from, to);
-                    if ((board.occupancy[0] | board.occupancy[1]) & (1ULL << to)) break; // Stop at first obstruction
-                }
+            Bitboard attacks = piece == WB ? bishop_attacks<B>(from, board.occupancy[2])
+                             : piece == WR ? rook_attacks<B>(from, board.occupancy[2])
+                                           : queen_attacks<B>(from, board.occupancy[2]);
+            attacks &= targets & ci.allowed(from);
+            while (attacks) {
+                moves.emplace_back(from, pop_lsb(attacks));
             }
         }
     }
 
-// Updated move generation functions
-    static void generate_bishop_moves(const Board &board, std::vector<Move> &moves, bool white) {
-        generate_slider_moves(board, moves, white, white ? WB : BB, bishop_directions, 4);
+    template<SliderBackend B>
+    static void generate_bishop_moves(const Board &board, MoveList &moves, bool white, Bitboard targets,
+                                      const CheckInfo &ci) {
+        generate_slider_moves<B>(board, moves, white, WB, targets, ci);
     }
 
-    static void generate_rook_moves(const Board &board, std::vector<Move> &moves, bool white) {
-        generate_slider_moves(board, moves, white, white ? WR : BR, rook_directions, 4);
+    template<SliderBackend B>
+    static void generate_rook_moves(const Board &board, MoveList &moves, bool white, Bitboard targets,
+                                    const CheckInfo &ci) {
+        generate_slider_moves<B>(board, moves, white, WR, targets, ci);
     }
 
-    static void generate_queen_moves(const Board &board, std::vector<Move> &moves, bool white) {
-        generate_slider_moves(board, moves, white, white ? WQ : BQ, queen_directions, 8);
+    template<SliderBackend B>
+    static void generate_queen_moves(const Board &board, MoveList &moves, bool white, Bitboard targets,
+                                     const CheckInfo &ci) {
+        generate_slider_moves<B>(board, moves, white, WQ, targets, ci);
     }
 
 
-    static void generate_king_moves(const Board &board, std::vector<Move> &moves, bool white) {
+    // The king may not step onto an attacked square; it is lifted off the board first so it
+    // cannot hide behind itself from a slider
+    template<SliderBackend B>
+    static void generate_king_moves(const Board &board, MoveList &moves, bool white, Bitboard targets) {
         Bitboard king = white ? board.pieces[WK] : board.pieces[BK];
-        Bitboard own = white ? board.occupancy[0] : board.occupancy[1];
         while (king) {
             int from = pop_lsb(king);
-            for (int d = 0; d < 8; ++d) {
-                int to = from + queen_directions[d];
-                if (to < 0 || to >= 64) continue;
-                // Handle wrapping
-                if (abs(to % 8 - from % 8) > 1) continue;
-                if (!(own & (1ULL << to))) {
-                    moves.emplace_back(from, to);
-                }
+            Bitboard occupied = board.occupancy[2] ^ (1ULL << from);
+            Bitboard attacks = KingAttacks[from] & targets;
+            while (attacks) {
+                int to = pop_lsb(attacks);
+                if (!attacked<B>(board, to, occupied)) moves.emplace_back(from, to);
+            }
+        }
+    }
+
+    // Whether 'move' is one generate_moves could return here, for moves from the hash table or
+    // killer slots that were found in another position
+    static bool is_legal(const Board &board, Move move, const CheckInfo &ci) {
+        return slider_backend == PEXT_BACKEND ? is_legal<PEXT_BACKEND>(board, move, ci)
+                                              : is_legal<MAGIC_BACKEND>(board, move, ci);
+    }
+
+    template<SliderBackend B>
+    static bool is_legal(const Board &board, Move move, const CheckInfo &ci) {
+        if (move == MOVE_NONE || move == MOVE_NULL) return false;
+        bool white = board.white_to_move;
+        int from = move.from();
+        int to = move.to();
+        Bitboard own = white ? board.occupancy[0] : board.occupancy[1];
+        Bitboard enemy = white ? board.occupancy[1] : board.occupancy[0];
+        if (!(own & (1ULL << from)) || (own & (1ULL << to))) return false;
+
+        if (move.flag() == CASTLING) {
+            if (ci.checkers) return false;
+            MoveList castles;
+            generate_castling_moves<B>(board, castles);
+            return std::find(castles.begin(), castles.end(), move) != castles.end();
+        }
+
+        int type = board.get_piece(from) % 6;
+        if (type == 0) {
+            int up = white ? 8 : -8;
+            if (move.is_promotion() != (to / 8 == (white ? 7 : 0))) return false;
+            bool capture = PawnAttacks[white ? 0 : 1][from] & (1ULL << to);
+            switch (move.flag()) {
+                case EN_PASSANT:
+                    return capture && to == board.en_passant && en_passant_legal<B>(board, from, to, ci);
+                case DOUBLE_PUSH:
+                    return from / 8 == (white ? 1 : 6) && to == from + 2 * up &&
+                           !(board.occupancy[2] & ((1ULL << (from + up)) | (1ULL << to))) &&
+                           (ci.allowed(from) & (1ULL << to));
+                default:
+                    if (to == from + up) return !(board.occupancy[2] & (1ULL << to)) && (ci.allowed(from) & (1ULL << to));
+                    return capture && (enemy & (1ULL << to)) && (ci.allowed(from) & (1ULL << to));
             }
         }
+        if (move.flag() != NORMAL) return false;
+
+        if (type == 5) {
+            return (KingAttacks[from] & (1ULL << to)) && !attacked<B>(board, to, board.occupancy[2] ^ (1ULL << from));
+        }
+        Bitboard attacks = type == 1 ? KnightAttacks[from]
+                         : type == 2 ? bishop_attacks<B>(from, board.occupancy[2])
+                         : type == 3 ? rook_attacks<B>(from, board.occupancy[2])
+                                     : queen_attacks<B>(from, board.occupancy[2]);
+        return attacks & ci.allowed(from) & (1ULL << to);
     }
 
-    static void generate_castling_moves(const Board &board, std::vector<Move> &moves) {
-        // Simplified castling: only if king and rook have not moved and squares between are empty
+    // Castling needs the rights, empty squares between king and rook, and the king must not be in
+    // check, pass through an attacked square or land on one
+    template<SliderBackend B>
+    static void generate_castling_moves(const Board &board, MoveList &moves) {
+        Bitboard occupied = board.occupancy[2];
         if (board.white_to_move) {
             // Kingside
-            if (board.castling_rights[0]) {
-                if (!(board.occupancy[0] | board.occupancy[1]) & 0x60) {
-                    moves.emplace_back(4, 6); // e1 to g1
+            if (board.castling_rights & CASTLE_WK) {
+                if (!(occupied & 0x60) && !attacked<B>(board, 4, occupied) && !attacked<B>(board, 5, occupied) &&
+                    !attacked<B>(board, 6, occupied)) {
+                    moves.emplace_back(4, 6, CASTLING); // e1 to g1
                 }
             }
             // Queenside
-            if (board.castling_rights[1]) {
-                if (!(board.occupancy[0] | board.occupancy[1]) & 0x1C) {
-                    moves.emplace_back(4, 2); // e1 to c1
+            if (board.castling_rights & CASTLE_WQ) {
+                if (!(occupied & 0x0E) && !attacked<B>(board, 4, occupied) && !attacked<B>(board, 3, occupied) &&
+                    !attacked<B>(board, 2, occupied)) {
+                    moves.emplace_back(4, 2, CASTLING); // e1 to c1
                 }
             }
         } else {
             // Kingside
-            if (board.castling_rights[2]) {
-                if (!(board.occupancy[0] | board.occupancy[1]) & 0x6000000000000000) {
-                    moves.emplace_back(60, 62); // e8 to g8
+            if (board.castling_rights & CASTLE_BK) {
+                if (!(occupied & 0x6000000000000000) && !attacked<B>(board, 60, occupied) &&
+                    !attacked<B>(board, 61, occupied) && !attacked<B>(board, 62, occupied)) {
+                    moves.emplace_back(60, 62, CASTLING); // e8 to g8
                 }
             }
             // Queenside
-            if (board.castling_rights[3]) {
-                if (!(board.occupancy[0] | board.occupancy[1]) & 0x1C00000000000000) {
-                    moves.emplace_back(60, 58); // e8 to c8
+            if (board.castling_rights & CASTLE_BQ) {
+                if (!(occupied & 0x0E00000000000000) && !attacked<B>(board, 60, occupied) &&
+                    !attacked<B>(board, 59, occupied) && !attacked<B>(board, 58, occupied)) {
+                    moves.emplace_back(60, 58, CASTLING); // e8 to c8
+                }
+            }
+        }
+    }
+};
+
+
+// Bound type of a stored score
+enum Bound {
+    BOUND_NONE,
+    BOUND_UPPER, // Failed low, real score <= stored score
+    BOUND_LOWER, // Failed high, real score >= stored score
+    BOUND_EXACT
+};
+
+// Decoded transposition table entry
+struct TTEntry {
+    Move move;
+    int score;
+    int depth;
+    int bound;
+};
+
+// Lock-free transposition table of 64-byte buckets, each holding four entries.
+// An entry is two 64-bit words, (key ^ data) and data. A torn write from another thread fails
+// the XOR check and reads as a miss, so no locking is needed.
+class TranspositionTable {
+    static constexpr int BUCKET_SIZE = 4;
+
+    struct alignas(64) Bucket {
+        std::atomic<uint64_t> words[2 * BUCKET_SIZE]; // Per entry: key ^ data, data
+    };
+
+    std::unique_ptr<Bucket[]> buckets;
+    size_t bucket_count = 0;
+    uint8_t generation = 0; // 6 bits, bumped once per search
+
+    // data layout: move (bits 0-15), depth (16-23), generation << 2 | bound (24-31), score (32-63)
+    static uint64_t pack(Move move, int score, int depth, int bound, int gen) {
+        return uint64_t(move.data) | uint64_t(uint8_t(depth)) << 16 |
+               uint64_t(gen << 2 | bound) << 24 | uint64_t(uint32_t(score)) << 32;
+    }
+
+    static int entry_depth(uint64_t data) { return int8_t(data >> 16); }
+    static int entry_generation(uint64_t data) { return (data >> 26) & 63; }
+
+    Bucket &bucket(uint64_t key) const {
+        return buckets[size_t((unsigned __int128) key * bucket_count >> 64)];
+    }
+
+public:
+    // Reallocates the table with 'mb' megabytes, dropping all entries; not safe during a search
+    void resize(size_t mb) {
+        bucket_count = std::max<size_t>(1, mb * 1024 * 1024 / sizeof(Bucket));
+        buckets.reset(new Bucket[bucket_count]);
+        clear();
+    }
+
+    void clear() {
+        for (size_t i = 0; i < bucket_count; ++i) {
+            for (auto &word: buckets[i].words) word.store(0, std::memory_order_relaxed);
+        }
+        generation = 0;
+    }
+
+    // Ages existing entries, call before each search
+    void new_search() {
+        generation = (generation + 1) & 63;
+    }
+
+    bool probe(uint64_t key, TTEntry &entry) const {
+        const Bucket &b = bucket(key);
+        for (int i = 0; i < BUCKET_SIZE; ++i) {
+            uint64_t check = b.words[2 * i].load(std::memory_order_relaxed);
+            uint64_t data = b.words[2 * i + 1].load(std::memory_order_relaxed);
+            if ((check ^ data) != key || data == 0) continue;
+            entry.move.data = uint16_t(data);
+            entry.depth = entry_depth(data);
+            entry.bound = (data >> 24) & 3;
+            entry.score = int32_t(data >> 32);
+            return true;
+        }
+        return false;
+    }
+
+    // Replaces the entry for 'key' if present, otherwise the shallowest and oldest entry
+    void store(uint64_t key, Move move, int score, int depth, int bound) {
+        Bucket &b = bucket(key);
+        int replace = 0;
+        int worst = INT_MAX;
+        for (int i = 0; i < BUCKET_SIZE; ++i) {
+            uint64_t check = b.words[2 * i].load(std::memory_order_relaxed);
+            uint64_t data = b.words[2 * i + 1].load(std::memory_order_relaxed);
+            if ((check ^ data) == key && data != 0) {
+                // Same position: keep the old move if we have none, and don't let a shallow
+                // non-exact result overwrite a much deeper one
+                if (move == MOVE_NONE) move.data = uint16_t(data);
+                if (bound != BOUND_EXACT && depth < entry_depth(data) - 2 &&
+                    entry_generation(data) == generation) return;
+                replace = i;
+                break;
+            }
+            int age = (generation - entry_generation(data)) & 63;
+            int value = data == 0 ? INT_MIN : entry_depth(data) - 8 * age;
+            if (value < worst) {
+                worst = value;
+                replace = i;
+            }
+        }
+        uint64_t data = pack(move, score, depth, bound, generation);
+        b.words[2 * replace].store(key ^ data, std::memory_order_relaxed);
+        b.words[2 * replace + 1].store(data, std::memory_order_relaxed);
+    }
+
+    // Permille of entries written by the current search, sampled over the first 1000 buckets
+    int hashfull() const {
+        size_t sample = std::min<size_t>(1000, bucket_count);
+        int used = 0;
+        for (size_t i = 0; i < sample; ++i) {
+            for (int j = 0; j < BUCKET_SIZE; ++j) {
+                uint64_t data = buckets[i].words[2 * j + 1].load(std::memory_order_relaxed);
+                if (data != 0 && entry_generation(data) == generation) used++;
+            }
+        }
+        return int(used * 1000 / (sample * BUCKET_SIZE));
+    }
+};
+
+constexpr size_t DEFAULT_HASH_MB = 16;
+
+TranspositionTable tt;
+
+// Direct-mapped cache of static evaluations. Each entry is one 32-bit word holding the low 16 bits
+// of the key and the score, so a write from another thread is never torn and needs no lock.
+class EvalCache {
+    std::unique_ptr<std::atomic<uint32_t>[]> entries;
+    size_t entry_count = 0;
+
+    std::atomic<uint32_t> &entry(uint64_t key) const {
+        return entries[size_t((unsigned __int128) key * entry_count >> 64)];
+    }
+
+public:
+    // Reallocates the cache with 'kb' kilobytes, dropping all entries; not safe during a search
+    void resize(size_t kb) {
+        entry_count = std::max<size_t>(1, kb * 1024 / sizeof(uint32_t));
+        entries.reset(new std::atomic<uint32_t>[entry_count]);
+        clear();
+    }
+
+    void clear() {
+        for (size_t i = 0; i < entry_count; ++i) entries[i].store(0, std::memory_order_relaxed);
+    }
+
+    // The index comes from the high bits of the key, the check from the low ones.
+    // An all-zero word is an empty entry and never a hit.
+    bool probe(uint64_t key, int &score) const {
+        uint32_t word = entry(key).load(std::memory_order_relaxed);
+        if (word == 0 || word >> 16 != uint16_t(key)) return false;
+        score = int16_t(uint16_t(word));
+        return true;
+    }
+
+    void store(uint64_t key, int score) {
+        entry(key).store(uint32_t(uint16_t(key)) << 16 | uint16_t(score), std::memory_order_relaxed);
+    }
+};
+
+constexpr size_t DEFAULT_EVAL_CACHE_KB = 256;
+
+EvalCache eval_cache;
+
+// Mate scores are stored relative to the node rather than the root, so they stay right
+// when the position is reached at another ply
+inline int score_to_tt(int score, int ply) {
+    return score >= MATE_IN_MAX_PLY ? score + ply : score <= -MATE_IN_MAX_PLY ? score - ply : score;
+}
+
+inline int score_from_tt(int score, int ply) {
+    return score >= MATE_IN_MAX_PLY ? score - ply : score <= -MATE_IN_MAX_PLY ? score + ply : score;
+}
+
+// UCI score string: "cp <centipawns>" or "mate <moves>", negative when getting mated
+std::string score_to_uci(int score) {
+    if (std::abs(score) < MATE_IN_MAX_PLY) return "cp " + std::to_string(score);
+    int moves = (MATE - std::abs(score) + 1) / 2;
+    return "mate " + std::to_string(score > 0 ? moves : -moves);
+}
+
+// Search limits from the 'go' command, zero means unset
+struct SearchLimits {
+    int time[2] = {0, 0}; // Remaining ms for white, black
+    int inc[2] = {0, 0};  // Increment ms for white, black
+    int movestogo = 0;
+    int movetime = 0;     // Exact time for this move in ms
+    uint64_t nodes = 0;
+    int depth = 0;
+    bool infinite = false; // Search until 'stop', and never send bestmove before it
+};
+
+// Milliseconds from a monotonic clock, or CPU time consumed by the calling thread
+int64_t now_ms(bool cpu_time) {
+    if (cpu_time) {
+        timespec ts{};
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return int64_t(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+    }
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Decides how long a search may run
+struct TimeManager {
+    bool cpu_time = false; // Measure thread CPU time instead of wall time
+    int move_overhead = 10; // ms reserved for communication lag
+    int64_t start = 0;
+    int64_t soft_limit = 0; // No new iteration is started past this, 0 if unlimited
+    int64_t hard_limit = 0; // The search is aborted past this, 0 if unlimited
+
+    void init(const SearchLimits &limits, bool white) {
+        start = now_ms(cpu_time);
+        soft_limit = hard_limit = 0;
+        if (limits.infinite) return;
+
+        if (limits.movetime) {
+            soft_limit = hard_limit = std::max(1, limits.movetime - move_overhead);
+            return;
+        }
+
+        int time = limits.time[white ? 0 : 1];
+        int inc = limits.inc[white ? 0 : 1];
+        if (!time) return;
+
+        // Spread the remaining time over the moves left, assuming 40 if unknown
+        int64_t available = std::max(1, time - move_overhead);
+        int moves_left = limits.movestogo ? std::min(limits.movestogo, 50) : 40;
+        soft_limit = std::min<int64_t>(available / moves_left + inc * 3 / 4, available / 2);
+        hard_limit = std::min<int64_t>(soft_limit * 4, available * 3 / 4);
+        soft_limit = std::max<int64_t>(1, std::min(soft_limit, hard_limit));
+        hard_limit = std::max(hard_limit, soft_limit);
+    }
+
+    int64_t elapsed() const {
+        return now_ms(cpu_time) - start;
+    }
+};
+
+// Limits are only checked every CHECK_INTERVAL nodes, reading the clock is not free
+constexpr uint64_t CHECK_INTERVAL = 1024;
+
+// State of one search
+struct SearchInfo {
+    SearchLimits limits;
+    TimeManager time;
+    uint64_t nodes = 0;
+    std::atomic<bool> stopped{false}; // Set by the search itself or by 'stop' from the UCI thread
+    StateInfo states[MAX_PLY]; // Irreversible state, one slot per ply
+    Move pv[MAX_PLY][MAX_PLY]; // Triangular PV table, pv[ply] holds the line from ply onwards
+    int pv_length[MAX_PLY];    // End (exclusive) of pv[ply]
+    Move root_move = MOVE_NONE; // Best root move of the last completed iteration
+    Move move_stack[MAX_PLY];   // Move played at each ply, MOVE_NULL for a null move
+
+    // Move ordering statistics, kept between searches and cleared on a new game
+    Move killers[MAX_PLY][2];   // Quiet moves that caused a cutoff at this ply, newest first
+    Move countermoves[12][64];  // Quiet refutation of the previous move, by its piece and target
+    int history[2][64][64];     // Butterfly history by side, from and to square
+
+    // Cutoff statistics of the current search
+    uint64_t cutoffs = 0;
+    uint64_t first_move_cutoffs = 0;
+
+    // Evaluation cache statistics of the current search
+    uint64_t eval_probes = 0;
+    uint64_t eval_hits = 0;
+
+    PawnTable pawn_table; // Pawn hash of the thread running this search, it outlives the thread
+
+    void clear_ordering() {
+        std::fill(&killers[0][0], &killers[0][0] + MAX_PLY * 2, MOVE_NONE);
+        std::fill(&countermoves[0][0], &countermoves[0][0] + 12 * 64, MOVE_NONE);
+        std::fill(&history[0][0][0], &history[0][0][0] + 2 * 64 * 64, 0);
+    }
+
+    SearchInfo() { clear_ordering(); }
+};
+
+// Static evaluation through the shared cache
+int cached_evaluate(const Board &board, SearchInfo &info) {
+    int score;
+    info.eval_probes++;
+    if (eval_cache.probe(board.key, score)) {
+        info.eval_hits++;
+        return score;
+    }
+    score = evaluate(board, info.pawn_table);
+    eval_cache.store(board.key, score);
+    return score;
+}
+
+// Search parameters, all settable through UCI options for tuning
+struct SearchParams {
+    int nmp_min_depth = 3;      // Null-move pruning only from this depth
+    int nmp_reduction = 3;      // Base reduction R of the null-move search
+    int nmp_depth_divisor = 4;  // R grows by depth / divisor
+    int nmp_eval_divisor = 200; // and by (eval - beta) / divisor, at most 3
+    int lmr_min_depth = 3;      // Late move reductions only from this depth
+    int lmr_min_moves = 3;      // Moves searched at full depth before reducing
+    int lmr_base = 75;          // Reduction = base / 100 + ln(depth) * ln(move number) * 100 / divisor
+    int lmr_divisor = 225;
+    int see_prune_depth = 6;    // Late quiet moves losing material by SEE are pruned up to this depth
+    int see_quiet_margin = 20;  // Material a pruned quiet move may lose, times depth squared
+};
+
+SearchParams params;
+
+// Tunable option name, bound and the parameter it sets
+struct TunableOption {
+    const char *name;
+    int *value;
+    int min;
+    int max;
+};
+
+const TunableOption tunable_options[] = {
+        {"NMPMinDepth", &params.nmp_min_depth, 1, 16},
+        {"NMPReduction", &params.nmp_reduction, 0, 8},
+        {"NMPDepthDivisor", &params.nmp_depth_divisor, 1, 16},
+        {"NMPEvalDivisor", &params.nmp_eval_divisor, 10, 1000},
+        {"LMRMinDepth", &params.lmr_min_depth, 1, 16},
+        {"LMRMinMoves", &params.lmr_min_moves, 1, 32},
+        {"LMRBase", &params.lmr_base, -200, 300},
+        {"LMRDivisor", &params.lmr_divisor, 50, 1000},
+        {"SEEPruneDepth", &params.see_prune_depth, 0, 16},
+        {"SEEQuietMargin", &params.see_quiet_margin, 0, 200},
+};
+
+// reductions[depth][move number] of late move reductions, rebuilt whenever the LMR options change
+int reductions[MAX_PLY][MAX_MOVES];
+
+void init_reductions() {
+    for (int depth = 1; depth < MAX_PLY; ++depth) {
+        for (int i = 1; i < MAX_MOVES; ++i) {
+            double r = params.lmr_base / 100.0 + std::log(depth) * std::log(i) * 100.0 / params.lmr_divisor;
+            reductions[depth][i] = std::max(0, int(r));
+        }
+    }
+}
+
+void check_limits(SearchInfo &info) {
+    if (info.limits.nodes && info.nodes >= info.limits.nodes) info.stopped = true;
+    if (info.time.hard_limit && info.time.elapsed() >= info.time.hard_limit) info.stopped = true;
+}
+
+constexpr int MAX_QSEARCH_DEPTH = 12; // Captures searched past the horizon at most
+constexpr int DELTA_MARGIN = 200;     // Slack for positional gains in delta pruning
+
+// Middlegame value of a piece for capture decisions, kings never get traded
+inline int capture_value(int piece) {
+    int type = piece % 6;
+    return type == 5 ? INF / 2 : piece_value[0][type];
+}
+
+// Static exchange evaluation: the material outcome of the exchange 'move' starts on its target
+// square, both sides recapturing with their least valuable attacker and free to stop at any point.
+// Sliders behind a capturing piece join in as it leaves the line. Pins are ignored.
+
+// Least valuable piece of 'side' (0 white, 1 black) among 'attackers', with its type, or -1
+inline int least_valuable_attacker(const Board &board, Bitboard attackers, int side, int &type) {
+    for (type = WP; type <= WK; ++type) {
+        Bitboard bb = attackers & board.pieces[type + 6 * side];
+        if (bb) return __builtin_ctzll(bb);
+    }
+    return -1;
+}
+
+// Bishops, rooks and queens of both sides attacking 'square' through 'occupied'
+template<SliderBackend B>
+inline Bitboard slider_attackers(const Board &board, int square, Bitboard occupied) {
+    return (bishop_attacks<B>(square, occupied) & (board.pieces[WB] | board.pieces[BB] | board.pieces[WQ] | board.pieces[BQ])) |
+           (rook_attacks<B>(square, occupied) & (board.pieces[WR] | board.pieces[BR] | board.pieces[WQ] | board.pieces[BQ]));
+}
+
+// Material won by the move itself, the value of the piece then left on the target square and the
+// occupancy with the mover and any captured piece lifted off
+inline void see_init(const Board &board, Move move, int &gain, int &on_square, Bitboard &occupied) {
+    int captured = board.get_piece(move.to());
+    occupied = board.occupancy[2] ^ (1ULL << move.from());
+    if (move.flag() == EN_PASSANT) {
+        captured = WP;
+        occupied ^= 1ULL << (move.to() + (board.white_to_move ? -8 : 8));
+    }
+    gain = captured == EMPTY ? 0 : capture_value(captured);
+    on_square = capture_value(board.get_piece(move.from()));
+    if (move.is_promotion()) {
+        on_square = piece_value[0][move.flag() - PROMO_N + 1];
+        gain += on_square - piece_value[0][0];
+    }
+}
+
+// Exact exchange value of 'move' by the swap-list algorithm
+template<SliderBackend B>
+int see(const Board &board, Move move) {
+    if (move.flag() == CASTLING) return 0;
+
+    int gain[32];
+    int on_square;
+    Bitboard occupied;
+    see_init(board, move, gain[0], on_square, occupied);
+
+    int to = move.to();
+    Bitboard attackers = attackers_to<B>(board, to, occupied) & occupied;
+    int side = board.white_to_move ? 1 : 0; // Side to recapture
+    int depth = 0;
+    while (depth < 31) {
+        int type;
+        int square = least_valuable_attacker(board, attackers & board.occupancy[side], side, type);
+        if (square == -1) break;
+
+        // A king may only capture when nothing can take it back
+        if (type == WK && (attackers & board.occupancy[side ^ 1])) break;
+
+        // Speculative: this capture is only made if it pays off once the rest is known
+        ++depth;
+        gain[depth] = on_square - gain[depth - 1];
+        on_square = capture_value(type);
+        occupied ^= 1ULL << square;
+        attackers = (attackers | slider_attackers<B>(board, to, occupied)) & occupied;
+        side ^= 1;
+    }
+
+    // Each side stands pat where capturing on would be worse
+    while (depth > 0) {
+        gain[depth - 1] = -std::max(-gain[depth - 1], gain[depth]);
+        --depth;
+    }
+    return gain[0];
+}
+
+// Whether see(board, move) >= threshold, stopping as soon as the answer is known
+template<SliderBackend B>
+bool see_ge(const Board &board, Move move, int threshold) {
+    if (move.flag() == CASTLING) return threshold <= 0;
+
+    int gain;
+    int on_square;
+    Bitboard occupied;
+    see_init(board, move, gain, on_square, occupied);
+
+    // 'swap' is how far the side that just captured is above the threshold if its piece is lost
+    int swap = gain - threshold;
+    if (swap < 0) return false;
+    swap = on_square - swap;
+    if (swap <= 0) return true;
+
+    int to = move.to();
+    Bitboard attackers = attackers_to<B>(board, to, occupied) & occupied;
+    int side = board.white_to_move ? 0 : 1;
+    int result = 1;
+    while (true) {
+        side ^= 1;
+        attackers &= occupied;
+        int type;
+        int square = least_valuable_attacker(board, attackers & board.occupancy[side], side, type);
+        if (square == -1) break;
+
+        // A king may only capture when nothing can take it back
+        if (type == WK) return (attackers & board.occupancy[side ^ 1]) ? result : result ^ 1;
+
+        result ^= 1;
+        swap = capture_value(type) - swap;
+        if (swap < result) break;
+        occupied ^= 1ULL << square;
+        attackers |= slider_attackers<B>(board, to, occupied);
+    }
+    return result;
+}
+
+int see(const Board &board, Move move) {
+    return slider_backend == PEXT_BACKEND ? see<PEXT_BACKEND>(board, move) : see<MAGIC_BACKEND>(board, move);
+}
+
+bool see_ge(const Board &board, Move move, int threshold) {
+    return slider_backend == PEXT_BACKEND ? see_ge<PEXT_BACKEND>(board, move, threshold)
+                                          : see_ge<MAGIC_BACKEND>(board, move, threshold);
+}
+
+constexpr int MAX_HISTORY = 16384; // History scores stay within [-MAX_HISTORY, MAX_HISTORY]
+
+// Gravity update: the bonus shrinks as the score approaches the bound, so old results fade
+inline void update_history(int &entry, int bonus) {
+    entry += bonus - entry * std::abs(bonus) / MAX_HISTORY;
+}
+
+// Stages of the move picker, in the order they are visited
+enum PickStage {
+    STAGE_TT,
+    STAGE_GEN_CAPTURES,
+    STAGE_GOOD_CAPTURES,
+    STAGE_KILLER_1,
+    STAGE_KILLER_2,
+    STAGE_COUNTER,
+    STAGE_GEN_QUIETS,
+    STAGE_QUIETS,
+    STAGE_BAD_CAPTURES,
+
+    STAGE_EVASION_TT,
+    STAGE_GEN_EVASIONS,
+    STAGE_EVASIONS,
+
+    STAGE_QS_GEN_CAPTURES,
+    STAGE_QS_CAPTURES,
+
+    STAGE_DONE
+};
+
+// Hands out moves best first: hash move, winning captures by MVV-LVA, killers, countermove,
+// quiets by history, then losing captures. Moves are generated in stages, so a cutoff on the
+// hash move or a capture never generates quiets, and each call to next() selects the best
+// remaining move of the stage, so moves after a cutoff are never sorted. In check, only
+// evasions are generated.
+template<SliderBackend B>
+class MovePicker {
+public:
+    MovePicker(const Board &board, Move tt_move, int ply, const SearchInfo &info)
+            : board(board), info(info), ply(ply), ci(CheckInfo::compute<B>(board)) {
+        stage = ci.checkers ? STAGE_EVASION_TT : STAGE_TT;
+        this->tt_move = MoveGenerator::is_legal<B>(board, tt_move, ci) ? tt_move : MOVE_NONE;
+        killers[0] = info.killers[ply][0];
+        killers[1] = info.killers[ply][1];
+        if (ply > 0) {
+            Move previous = info.move_stack[ply - 1];
+            if (previous != MOVE_NULL) counter = info.countermoves[board.get_piece(previous.to())][previous.to()];
+        }
+    }
+
+    // Quiescence search picker: captures and promotions only, by MVV-LVA
+    MovePicker(const Board &board, int ply, const SearchInfo &info)
+            : board(board), info(info), ply(ply), stage(STAGE_QS_GEN_CAPTURES), ci(CheckInfo::compute<B>(board)) {}
+
+    // Next move to search, MOVE_NONE once all are
+    Move next() {
+        while (true) {
+            switch (stage) {
+                case STAGE_TT:
+                case STAGE_EVASION_TT:
+                    ++stage;
+                    if (tt_move != MOVE_NONE) return tt_move;
+                    break;
+
+                case STAGE_GEN_CAPTURES:
+                case STAGE_QS_GEN_CAPTURES:
+                    MoveGenerator::generate<B>(board, moves, GEN_CAPTURES, ci);
+                    score_captures();
+                    ++stage;
+                    break;
+
+                case STAGE_GOOD_CAPTURES:
+                    while (current < moves.size()) {
+                        Move move = select_best();
+                        if (move == tt_move) continue;
+                        // Losing captures and underpromotions wait until after the quiets
+                        if (!see_ge<B>(board, move, 0) || (move.is_promotion() && move.flag() != PROMO_Q)) {
+                            bad_captures.emplace_back(move);
+                            continue;
+                        }
+                        return move;
+                    }
+                    ++stage;
+                    break;
+
+                case STAGE_KILLER_1:
+                case STAGE_KILLER_2:
+                case STAGE_COUNTER: {
+                    Move move = stage == STAGE_COUNTER ? counter : killers[stage - STAGE_KILLER_1];
+                    bool repeated = (stage >= STAGE_KILLER_2 && move == killers[0]) ||
+                                    (stage == STAGE_COUNTER && move == killers[1]);
+                    ++stage;
+                    if (move != tt_move && !repeated && is_quiet(move) && MoveGenerator::is_legal<B>(board, move, ci)) {
+                        return move;
+                    }
+                    break;
                 }
+
+                case STAGE_GEN_QUIETS:
+                    moves.clear();
+                    current = 0;
+                    MoveGenerator::generate<B>(board, moves, GEN_QUIETS, ci);
+                    score_quiets();
+                    ++stage;
+                    break;
+
+                case STAGE_QUIETS:
+                    while (current < moves.size()) {
+                        Move move = select_best();
+                        if (move == tt_move || move == killers[0] || move == killers[1] || move == counter) continue;
+                        return move;
+                    }
+                    ++stage;
+                    break;
+
+                case STAGE_BAD_CAPTURES:
+                    if (bad_current < bad_captures.size()) return bad_captures[bad_current++];
+                    stage = STAGE_DONE;
+                    break;
+
+                case STAGE_GEN_EVASIONS:
+                    MoveGenerator::generate<B>(board, moves, GEN_EVASIONS, ci);
+                    score_evasions();
+                    ++stage;
+                    break;
+
+                case STAGE_EVASIONS:
+                case STAGE_QS_CAPTURES:
+                    while (current < moves.size()) {
+                        Move move = select_best();
+                        if (move == tt_move) continue;
+                        return move;
+                    }
+                    stage = STAGE_DONE;
+                    break;
+
+                default:
+                    return MOVE_NONE;
             }
         }
     }
+
+private:
+    static constexpr int CAPTURE_SCORE = 1 << 28;
+
+    const Board &board;
+    const SearchInfo &info;
+    int ply;
+    int stage;
+    CheckInfo ci;
+    Move tt_move = MOVE_NONE;
+    Move killers[2];
+    Move counter = MOVE_NONE;
+
+    MoveList moves;
+    int scores[MAX_MOVES];
+    int current = 0;
+    MoveList bad_captures;
+    int bad_current = 0;
+
+    bool is_quiet(Move move) const {
+        return move.flag() != EN_PASSANT && !move.is_promotion() && board.get_piece(move.to()) == EMPTY;
+    }
+
+    // Most valuable victim first, least valuable attacker breaks ties; queen promotions count as a capture
+    int mvv_lva(Move move) const {
+        int victim = move.flag() == EN_PASSANT ? WP : board.get_piece(move.to());
+        return (victim != EMPTY ? victim % 6 : 0) * 8 + (move.flag() == PROMO_Q ? 40 : 0) +
+               5 - board.get_piece(move.from()) % 6;
+    }
+
+    void score_captures() {
+        for (int i = 0; i < moves.size(); ++i) scores[i] = mvv_lva(moves[i]);
+    }
+
+    void score_quiets() {
+        int side = board.white_to_move ? 0 : 1;
+        for (int i = 0; i < moves.size(); ++i) scores[i] = info.history[side][moves[i].from()][moves[i].to()];
+    }
+
+    void score_evasions() {
+        int side = board.white_to_move ? 0 : 1;
+        for (int i = 0; i < moves.size(); ++i) {
+            Move move = moves[i];
+            scores[i] = is_quiet(move) ? info.history[side][move.from()][move.to()] : CAPTURE_SCORE + mvv_lva(move);
+        }
+    }
+
+    // Partial selection sort: swaps the best remaining move to the front and returns it
+    Move select_best() {
+        int best = current;
+        for (int i = current + 1; i < moves.size(); ++i) {
+            if (scores[i] > scores[best]) best = i;
+        }
+        std::swap(moves[current], moves[best]);
+        std::swap(scores[current], scores[best]);
+        return moves[current++];
+    }
 };
 
+// Quiescence search: only captures and queen promotions, so the static evaluation is taken
+// in a quiet position. 'qdepth' counts plies since the main search horizon.
+template<SliderBackend B>
+int qsearch(Board &board, int ply, int qdepth, int alpha, int beta, SearchInfo &info) {
+    if (++info.nodes % CHECK_INTERVAL == 0) check_limits(info);
+    if (info.stopped) return 0;
+
+    // Stand pat: the side to move may decline every capture
+    int stand_pat = cached_evaluate(board, info);
+    if (stand_pat >= beta || qdepth >= MAX_QSEARCH_DEPTH || ply >= MAX_PLY - 1) return stand_pat;
+    alpha = std::max(alpha, stand_pat);
+
+    MovePicker<B> picker(board, ply, info);
+    int best = stand_pat;
+    Move move;
+    while ((move = picker.next()) != MOVE_NONE) {
+        bool promotion = move.flag() == PROMO_Q;
+        int victim = move.flag() == EN_PASSANT ? (board.white_to_move ? BP : WP) : board.get_piece(move.to());
+        if (victim == EMPTY && !promotion) continue; // Underpromotion
+
+        // Delta pruning: skip if even winning the piece for free cannot reach alpha
+        int gain = (victim != EMPTY ? capture_value(victim) : 0) +
+                   (promotion ? piece_value[0][4] - piece_value[0][0] : 0);
+        if (stand_pat + gain + DELTA_MARGIN <= alpha) continue;
+
+        // Skip captures that lose material
+        if (!see_ge<B>(board, move, 0)) continue;
+
+        board.make_move(move, info.states[ply]);
+        int score = -qsearch<B>(board, ply + 1, qdepth + 1, -beta, -alpha, info);
+        board.unmake_move(move, info.states[ply]);
+        if (info.stopped) return 0;
+
+        if (score > best) {
+            best = score;
+            if (score > alpha) {
+                alpha = score;
+                if (alpha >= beta) break;
+            }
+        }
+    }
+    return best;
+}
 
-// Negamax with Alpha-Beta Pruning
-int negamax(Board board, int depth, int alpha, int beta, Move &best_move) {
+// Principal variation search with alpha-beta pruning
+// Moves after the first are searched with a null window and only re-searched with the full window
+// if they beat alpha. Fills the triangular PV table for this ply; returns 0 once stopped.
+template<SliderBackend B>
+int negamax(Board &board, int depth, int ply, int alpha, int beta, SearchInfo &info) {
+    info.pv_length[ply] = ply;
     if (depth == 0) {
-        return evaluate(board);
+        return qsearch<B>(board, ply, 0, alpha, beta, info);
     }
-    std::vector<Move> moves;
-    MoveGenerator::generate_moves(board, moves);
-    if (moves.empty()) {
-        // Checkmate or stalemate
-        return evaluate(board);
+
+    if (++info.nodes % CHECK_INTERVAL == 0) check_limits(info);
+    if (info.stopped) return 0;
+
+    if (ply >= MAX_PLY - 1) {
+        return cached_evaluate(board, info);
+    }
+
+    bool pv_node = beta - alpha > 1;
+    bool checked = in_check<B>(board);
+
+    // Transposition table cutoff, only in null-window nodes so the PV stays intact
+    TTEntry entry;
+    bool tt_hit = tt.probe(board.key, entry);
+    if (tt_hit) entry.score = score_from_tt(entry.score, ply);
+    if (!pv_node && tt_hit && entry.depth >= depth) {
+        if (entry.bound == BOUND_EXACT ||
+            (entry.bound == BOUND_LOWER && entry.score >= beta) ||
+            (entry.bound == BOUND_UPPER && entry.score <= alpha)) {
+            return entry.score;
+        }
     }
+
+    // Null-move pruning: if passing still fails high, a real move almost surely does too.
+    // Not in check, not twice in a row, and only with pieces left, since zugzwang is common
+    // in pawn endings.
+    int us = board.white_to_move ? 0 : 6;
+    bool has_pieces = board.pieces[WN + us] | board.pieces[WB + us] | board.pieces[WR + us] | board.pieces[WQ + us];
+    if (!pv_node && !checked && depth >= params.nmp_min_depth && has_pieces &&
+        (ply == 0 || info.move_stack[ply - 1] != MOVE_NULL)) {
+        int static_eval = cached_evaluate(board, info);
+        if (static_eval >= beta) {
+            int r = params.nmp_reduction + depth / params.nmp_depth_divisor +
+                    std::min(3, (static_eval - beta) / params.nmp_eval_divisor);
+            info.move_stack[ply] = MOVE_NULL;
+            board.make_null_move(info.states[ply]);
+            int eval = -negamax<B>(board, std::max(0, depth - 1 - r), ply + 1, -beta, -beta + 1, info);
+            board.unmake_null_move(info.states[ply]);
+            if (info.stopped) return 0;
+            if (eval >= beta) return eval;
+        }
+    }
+
+    MovePicker<B> picker(board, tt_hit ? entry.move : MOVE_NONE, ply, info);
+    int alpha_orig = alpha;
     int max_eval = -INF;
-    for (auto &move: moves) {
-        // Make move
-        Board new_board = board;
-        int captured = new_board.get_piece(move.to);
-        new_board.set_piece(move.to, move.promotion != EMPTY ? move.promotion : new_board.get_piece(move.from));
-        new_board.set_piece(move.from, EMPTY);
-        // Toggle side
-        new_board.white_to_move = !new_board.white_to_move;
-        // Recursive call
-        int eval = -negamax(new_board, depth - 1, -beta, -alpha, best_move);
-//        if (depth == 1 && move.from == 26 && move.to == 20) {
-//            std::cout << eval << '\n';
-//        }
+    Move node_best = MOVE_NONE;
+    Move quiets[MAX_MOVES]; // Quiet moves searched so far, penalised on a quiet cutoff
+    int quiet_count = 0;
+    int side = board.white_to_move ? 0 : 1;
+    Move move;
+    for (int i = 0; (move = picker.next()) != MOVE_NONE; ++i) {
+        bool quiet = board.get_piece(move.to()) == EMPTY && move.flag() != EN_PASSANT && !move.is_promotion();
+
+        // SEE pruning: at shallow depth, a late quiet move that hangs material is not searched
+        if (!pv_node && !checked && quiet && i >= params.lmr_min_moves && depth <= params.see_prune_depth &&
+            max_eval > -MATE_IN_MAX_PLY && !see_ge<B>(board, move, -params.see_quiet_margin * depth * depth)) {
+            continue;
+        }
+
+        info.move_stack[ply] = move;
+        board.make_move(move, info.states[ply]);
+        if (quiet) quiets[quiet_count++] = move;
+        int eval;
+        if (i == 0) {
+            eval = -negamax<B>(board, depth - 1, ply + 1, -beta, -alpha, info);
+        } else {
+            // Late move reductions: quiet moves ordered late are searched shallower first
+            int r = 0;
+            if (quiet && !checked && depth >= params.lmr_min_depth && i >= params.lmr_min_moves) {
+                r = reductions[depth][std::min(i, MAX_MOVES - 1)] - pv_node;
+                r = std::max(0, std::min(r, depth - 2));
+            }
+            eval = -negamax<B>(board, depth - 1 - r, ply + 1, -alpha - 1, -alpha, info);
+            if (eval > alpha && r > 0) {
+                eval = -negamax<B>(board, depth - 1, ply + 1, -alpha - 1, -alpha, info);
+            }
+            if (eval > alpha && eval < beta) {
+                eval = -negamax<B>(board, depth - 1, ply + 1, -beta, -alpha, info);
+            }
+        }
+        board.unmake_move(move, info.states[ply]);
+        if (info.stopped) return 0;
+
         if (eval > max_eval) {
             max_eval = eval;
-            if (depth == 1) {
-                best_move = move;
-            }
+            node_best = move;
         }
-        alpha = std::max(alpha, eval);
-        if (alpha >= beta) {
-            break; // Beta cutoff
+        if (eval > alpha) {
+            alpha = eval;
+
+            // This move heads the PV, followed by the child's line
+            info.pv[ply][ply] = move;
+            for (int j = ply + 1; j < info.pv_length[ply + 1]; ++j) {
+                info.pv[ply][j] = info.pv[ply + 1][j];
+            }
+            info.pv_length[ply] = std::max(ply + 1, info.pv_length[ply + 1]);
+
+            if (alpha >= beta) {
+                // Beta cutoff: reward a quiet move that caused it and punish the quiets tried before
+                info.cutoffs++;
+                if (i == 0) info.first_move_cutoffs++;
+                if (quiet) {
+                    if (info.killers[ply][0] != move) {
+                        info.killers[ply][1] = info.killers[ply][0];
+                        info.killers[ply][0] = move;
+                    }
+                    if (ply > 0 && info.move_stack[ply - 1] != MOVE_NULL) {
+                        Move previous = info.move_stack[ply - 1];
+                        info.countermoves[board.get_piece(previous.to())][previous.to()] = move;
+                    }
+                    int bonus = std::min(depth * depth, 1200);
+                    for (int j = 0; j < quiet_count; ++j) {
+                        Move tried = quiets[j];
+                        update_history(info.history[side][tried.from()][tried.to()], tried == move ? bonus : -bonus);
+                    }
+                }
+                break;
+            }
         }
     }
+
+    if (node_best == MOVE_NONE) {
+        // No legal move: checkmate or stalemate
+        return checked ? -MATE + ply : 0;
+    }
+
+    int bound = max_eval >= beta ? BOUND_LOWER : max_eval > alpha_orig ? BOUND_EXACT : BOUND_UPPER;
+    tt.store(board.key, node_best, score_to_tt(max_eval, ply), depth, bound);
     return max_eval;
 }
 
-// Main function
-int main() {
-    Board board;
-    board.initialize();
-//    board.import_fen("r4b2/2pk4/p2p4/1P1b4/3P4/8/1Pn2PPP/2B3K1 w - - 1");
-    board.import_fen("rnbqkbnr/pppp1ppp/8/4pQ2/4P1B1/2N1B3/PPPP1PPP/R3K1NR b KQkq - 1 2");
-    int tmp = 0;
-    for (int i = 0; i < 64; i++) {
-        tmp += knight_attack(board, i);
+// Formats a move in UCI long algebraic notation, e.g. e2e4 or e7e8q
+std::string move_to_uci(Move move) {
+    if (move == MOVE_NONE) return "0000";
+    std::string str;
+    str += char('a' + move.from() % 8);
+    str += char('1' + move.from() / 8);
+    str += char('a' + move.to() % 8);
+    str += char('1' + move.to() / 8);
+    if (move.is_promotion()) str += "nbrq"[move.flag() - PROMO_N];
+    return str;
+}
+
+// Finds the generated move matching a UCI string, MOVE_NONE if there is none
+Move parse_uci_move(const Board &board, const std::string &str) {
+    MoveList moves;
+    MoveGenerator::generate_moves(board, moves);
+    for (Move move: moves) {
+        if (move_to_uci(move) == str) return move;
     }
-    std::cout << tmp << '\n';
-    std::cout << evaluate(board) << '\n';
+    return MOVE_NONE;
+}
 
-    while (true) {
-        std::vector<Move> moves;
-        MoveGenerator::generate_moves(board, moves);
-//        for (const auto selected_move : moves) {
-//            std::cout << "Move: " << char('a' + selected_move.from%8) << (selected_move.from/8 +1)
-//                      << char('a' + selected_move.to%8) << (selected_move.to/8 +1) << std::endl;
-//        }
-        if (moves.empty()) {
-            std::cout << "Game Over." << std::endl;
-            break;
+constexpr int ASPIRATION_DEPTH = 4;  // First depth searched with an aspiration window
+constexpr int ASPIRATION_WINDOW = 40; // Initial half-width around the previous score
+
+// Iterative deepening driver: searches depth 1, 2, ... until a limit is hit and returns the best move
+// of the last completed iteration. From ASPIRATION_DEPTH on, each iteration starts with a narrow
+// window around the previous score and widens it on the side that failed.
+template<SliderBackend B>
+Move search(Board &board, SearchInfo &info) {
+    info.nodes = 0;
+    info.root_move = MOVE_NONE;
+    info.cutoffs = 0;
+    info.first_move_cutoffs = 0;
+    info.eval_probes = 0;
+    info.eval_hits = 0;
+    info.time.init(info.limits, board.white_to_move);
+    tt.new_search();
+
+    int max_depth = info.limits.depth ? std::min(info.limits.depth, MAX_PLY - 1) : MAX_PLY - 1;
+    int score = 0;
+    for (int depth = 1; depth <= max_depth; ++depth) {
+        int delta = ASPIRATION_WINDOW;
+        int alpha = -INF;
+        int beta = INF;
+        if (depth >= ASPIRATION_DEPTH) {
+            alpha = std::max(score - delta, -INF);
+            beta = std::min(score + delta, INF);
         }
 
-        // Find best move using Negamax
-        Move selected_move;
-        int score = negamax(board, 3, -INF, INF, selected_move); // Depth 3
+        while (true) {
+            int result = negamax<B>(board, depth, 0, alpha, beta, info);
+            if (info.stopped) break;
 
-        // Apply best move
-        // For simplicity, find the move with 'to' == best_move
-//        Move selected_move;
-//        for(auto &m: moves){
-//            if(m.to == best_move){
-//                selected_move = m;
-//                break;
-//            }
-//        }
+            if (result <= alpha) {
+                beta = (alpha + beta) / 2;
+                alpha = std::max(result - delta, -INF);
+            } else if (result >= beta) {
+                beta = std::min(result + delta, INF);
+            } else {
+                score = result;
+                break;
+            }
+            delta *= 2;
+        }
 
-        if (selected_move.to == -1) {
-            std::cout << "No valid moves." << std::endl;
+        // An interrupted iteration is only trusted if there is nothing better
+        if (info.stopped) {
+            if (info.root_move == MOVE_NONE && info.pv_length[0] > 0) info.root_move = info.pv[0][0];
             break;
         }
+        if (info.pv_length[0] > 0) info.root_move = info.pv[0][0];
+
+        int64_t elapsed = info.time.elapsed();
+        std::cout << "info depth " << depth << " score " << score_to_uci(score) << " nodes " << info.nodes
+                  << " nps " << info.nodes * 1000 / std::max<int64_t>(1, elapsed) << " time " << elapsed
+                  << " hashfull " << tt.hashfull() << " pv";
+        for (int i = 0; i < info.pv_length[0]; ++i) std::cout << ' ' << move_to_uci(info.pv[0][i]);
+        std::cout << std::endl;
 
-        // Make the move
-        int captured = board.get_piece(selected_move.to);
-        board.set_piece(selected_move.to, selected_move.promotion != EMPTY ? selected_move.promotion : board.get_piece(
-                selected_move.from));
-        board.set_piece(selected_move.from, EMPTY);
-        board.white_to_move = !board.white_to_move;
+        if (info.root_move == MOVE_NONE) break; // Mated or stalemated, there is nothing to search
+        if (info.time.soft_limit && elapsed >= info.time.soft_limit) break;
+    }
+
+    // Share of cutoffs on the first move searched, the usual measure of move ordering quality
+    if (info.cutoffs) {
+        std::cout << "info string first move cutoffs " << std::fixed << std::setprecision(1)
+                  << 100.0 * info.first_move_cutoffs / info.cutoffs << "%" << std::defaultfloat << std::endl;
+    }
+    if (info.eval_probes) {
+        std::cout << "info string eval cache hits " << std::fixed << std::setprecision(1)
+                  << 100.0 * info.eval_hits / info.eval_probes << "%" << std::defaultfloat << std::endl;
+    }
 
-        // Output the move
-        std::cout << "Move: " << char('a' + selected_move.from % 8) << (selected_move.from / 8 + 1)
-                  << char('a' + selected_move.to % 8) << (selected_move.to / 8 + 1) << std::endl;
-        std::cout << score;
-        return 0;
+    // Stopped before a single root move was searched: fall back to any move
+    if (info.root_move == MOVE_NONE) {
+        MoveList moves;
+        MoveGenerator::generate_moves(board, moves);
+        if (!moves.empty()) info.root_move = moves[0];
+    }
+    return info.root_move;
+}
+
+// The slider backend is fixed for the whole search, so everything below runs its own instantiation.
+// 'info.stopped' must be cleared by the caller before the search starts, so an early 'stop' is not lost.
+Move search(Board &board, SearchInfo &info) {
+    return slider_backend == PEXT_BACKEND ? search<PEXT_BACKEND>(board, info) : search<MAGIC_BACKEND>(board, info);
+}
+
+// Attack sets of 'backend' for the sampled occupancies, and queen lookups timed in ns each
+template<SliderBackend B>
+double time_slider_backend(const std::vector<Bitboard> &occupancies, int rounds, std::vector<Bitboard> &attacks) {
+    init_attack_tables(B);
+    int samples = int(occupancies.size());
+    attacks.clear();
+    for (int i = 0; i < samples; ++i) {
+        attacks.push_back(bishop_attacks<B>(i % 64, occupancies[i]));
+        attacks.push_back(rook_attacks<B>(i % 64, occupancies[i]));
+    }
+
+    Bitboard checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; ++r) {
+        for (int i = 0; i < samples; ++i) {
+            checksum ^= queen_attacks<B>((i + r) % 64, occupancies[i] ^ checksum);
+        }
+    }
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    attacks.push_back(checksum);
+    return double(ns) / (double(samples) * rounds);
+}
+
+// Times slider lookups under each available backend and checks they agree on every attack set
+int bench_sliders() {
+    const int samples = 1 << 16;
+    const int rounds = 64;
+    std::mt19937_64 rng(2024);
+    std::vector<Bitboard> occupancies(samples);
+    for (auto &occ: occupancies) occ = rng() & rng();
+
+    std::vector<Bitboard> reference;
+    double ns = time_slider_backend<MAGIC_BACKEND>(occupancies, rounds, reference);
+    std::cout << "magic  " << ns << " ns/queen lookup  (checksum " << reference.back() << ")" << std::endl;
+
+    if (cpu_has_bmi2()) {
+        std::vector<Bitboard> attacks;
+        ns = time_slider_backend<PEXT_BACKEND>(occupancies, rounds, attacks);
+        std::cout << "pext   " << ns << " ns/queen lookup  (checksum " << attacks.back() << ")" << std::endl;
+        if (attacks != reference) {
+            std::cout << "Slider backends disagree" << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Positions shared by the benchmarks
+const char *const bench_fens[] = {
+        "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+        "rnbqkbnr/pppp1ppp/8/4pQ2/4P1B1/2N1B3/PPPP1PPP/R3K1NR b KQkq - 1 2",
+        "r2qrk2/p1p1b1pp/3p1n2/pN2p3/2Q1P3/P3B3/1PP2PPP/3RR1K1 b - - 3 17",
+        "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+};
+
+// Times the per-square eval helpers over every square of the bench positions
+int bench_eval() {
+    std::vector<Board> boards;
+    for (const char *fen: bench_fens) {
+        boards.emplace_back();
+        boards.back().import_fen(fen);
+    }
+
+    auto run = [&](const char *name, int iterations, auto &&helper) {
+        long long total = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            for (const Board &board: boards) {
+                for (int sq = 0; sq < 64; ++sq) total += helper(board, sq);
+            }
+        }
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        std::cout << name << "  " << double(ns) / (double(iterations) * boards.size() * 64)
+                  << " ns/square  (sum " << total << ")" << std::endl;
+    };
+
+    run("pinned_direction  ", 2000, [](const Board &b, int sq) { return pinned_direction(b, sq); });
+    run("knight_attack     ", 2000, [](const Board &b, int sq) { return knight_attack(b, sq); });
+    run("bishop_xray_attack", 2000, [](const Board &b, int sq) { return bishop_xray_attack(b, sq); });
+    run("rook_xray_attack  ", 2000, [](const Board &b, int sq) { return rook_xray_attack(b, sq); });
+    run("queen_attack      ", 2000, [](const Board &b, int sq) { return queen_attack(b, sq); });
+    run("mobility_area     ", 200, [](const Board &b, int sq) { return mobility_area(b, sq); });
+    run("mobility          ", 2000, [](const Board &b, int sq) { return mobility(b, sq); });
+    run("mobility_bonus    ", 2000, [](const Board &b, int sq) { return mobility_bonus(b, sq); });
+
+    // AttackInfo must agree with the helpers on every square, for either side to move
+    for (const Board &board: boards) {
+        for (int side = 0; side < 2; ++side) {
+            Board b = board;
+            b.white_to_move = side == 0;
+            AttackInfo ai(b);
+            int enemy = b.white_to_move ? 1 : 0;
+            for (int sq = 0; sq < 64; ++sq) {
+                if (ai.knight_count[enemy][sq] != knight_attack(b, sq) ||
+                    ai.bishop_count[enemy][sq] != bishop_xray_attack(b, sq) ||
+                    ai.rook_count[enemy][sq] != rook_xray_attack(b, sq) ||
+                    ai.queen_count[enemy][sq] != queen_attack(b, sq)) {
+                    std::cout << "AttackInfo disagrees with the helpers on square " << sq << std::endl;
+                    return 1;
+                }
+            }
+        }
+    }
+    // One AttackInfo against asking the helpers about all 64 squares
+    {
+        const int iterations = 20000;
+        long long total = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            for (const Board &board: boards) {
+                AttackInfo ai(board);
+                int enemy = board.white_to_move ? 1 : 0;
+                for (int sq = 0; sq < 64; ++sq) {
+                    total += ai.knight_count[enemy][sq] + ai.bishop_count[enemy][sq] + ai.rook_count[enemy][sq] +
+                             ai.queen_count[enemy][sq];
+                }
+            }
+        }
+        auto middle = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            for (const Board &board: boards) {
+                for (int sq = 0; sq < 64; ++sq) {
+                    total -= knight_attack(board, sq) + bishop_xray_attack(board, sq) + rook_xray_attack(board, sq) +
+                             queen_attack(board, sq);
+                }
+            }
+        }
+        auto end = std::chrono::steady_clock::now();
+        auto per_board = [&](auto from, auto to) {
+            return double(std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count()) /
+                   (double(iterations) * boards.size());
+        };
+        std::cout << "attack counts      " << per_board(start, middle) << " ns/board with AttackInfo, "
+                  << per_board(middle, end) << " with the helpers  (diff " << total << ")" << std::endl;
+    }
+
+    // Whole-board totals, the way an evaluation would ask for them
+    auto start = std::chrono::steady_clock::now();
+    long long total = 0;
+    const int iterations = 20000;
+    for (int i = 0; i < iterations; ++i) {
+        for (const Board &board: boards) total += mobility_bonus(board, -1, true) + mobility_bonus(board, -1, false);
+    }
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "mobility_bonus(-1) " << double(ns) / (2.0 * iterations * boards.size())
+              << " ns/board   (sum " << total << ")" << std::endl;
+    return 0;
+}
+
+// Checks the evaluation is colour-symmetric: from the side to move's point of view a position
+// and its colour-flipped twin must score the same. Walks a few plies from each bench position.
+int bench_symmetry() {
+    long long positions = 0;
+    bool ok = true;
+    auto pawns = std::make_unique<PawnTable>();
+    std::function<void(Board &, int)> walk = [&](Board &board, int depth) {
+        Board flipped = colorflip(board);
+        Board back = colorflip(flipped);
+        positions++;
+        if (evaluate(board, *pawns) != evaluate(flipped, *pawns) || back.key != board.key ||
+            !std::equal(std::begin(back.mailbox), std::end(back.mailbox), std::begin(board.mailbox))) {
+            if (ok) std::cout << "Asymmetric evaluation: " << evaluate(board, *pawns) << " vs " << evaluate(flipped, *pawns)
+                              << std::endl;
+            ok = false;
+        }
+        if (depth == 0) return;
+
+        MoveList moves;
+        MoveGenerator::generate_moves(board, moves);
+        StateInfo st;
+        for (Move move: moves) {
+            board.make_move(move, st);
+            walk(board, depth - 1);
+            board.unmake_move(move, st);
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    for (const char *fen: bench_fens) {
+        Board board;
+        board.import_fen(fen);
+        walk(board, 2);
+    }
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "symmetry " << (ok ? "ok" : "FAILED") << " over " << positions << " positions (" << ms << " ms)"
+              << std::endl;
+    return ok ? 0 : 1;
+}
+
+// Tactical SEE positions with hand-checked exchange values, for see and see_ge
+int bench_see() {
+    const int P = piece_value[0][0], N = piece_value[0][1], R = piece_value[0][3], Q = piece_value[0][4];
+    struct SeeCase {
+        const char *fen;
+        const char *move;
+        int value;
+    };
+    const SeeCase cases[] = {
+            {"4k3/8/8/4p3/8/8/8/4R1K1 w - - 0 1", "e1e5", P},                                 // Free pawn
+            {"4k3/8/3p4/4p3/8/8/8/4R1K1 w - - 0 1", "e1e5", P - R},                           // Pawn takes back
+            {"1k1r4/1pp4p/p7/4p3/8/P5P1/1PP4P/2K1R3 w - - 0 1", "e1e5", P},
+            {"1k1r3q/1ppn3p/p4b2/4p3/8/P2N2P1/1PP1R1BP/2K1Q3 w - - 0 1", "d3e5", P - N},     // Long exchange
+            {"4k3/8/2p5/3n4/8/4N3/8/4K3 w - - 0 1", "e3d5", 0},                               // Even trade
+            {"3rk3/8/8/3p4/8/8/3R4/3RK3 w - - 0 1", "d2d5", P},                               // Rook x-ray
+            {"4k3/3n4/8/4p3/3P4/2B5/8/4K3 w - - 0 1", "d4e5", P},                             // Bishop x-ray
+            {"4k3/8/3p4/8/8/8/8/4QK2 w - - 0 1", "e1e5", -Q},                                 // Quiet move hangs
+            {"4k3/8/8/3pP3/8/8/8/4K3 w - d6 0 1", "e5d6", P},                                 // En passant
+            {"4k3/3p4/8/8/8/8/3R4/3RK3 w - - 0 1", "d2d7", P},                                // King cannot take back
+            {"4k3/3p4/8/8/8/8/8/3RK3 w - - 0 1", "d1d7", P - R},                              // King takes back
+            {"1n2k3/P7/8/8/8/8/8/4K3 w - - 0 1", "a7b8q", N + Q - P},                         // Capture promotion
+            {"4k3/8/8/8/4p3/3P4/4K3/8 b - - 0 1", "e4d3", 0},                                 // Black to move
+            {"r1b2b1r/ppNk3p/n1p1p1p1/2P1KpP1/1n6/4P3/P2PBP2/R1BQ2NR w - - 0 1", "c7e6", P},  // King recapture guarded
+    };
+
+    int failures = 0;
+    for (const SeeCase &c: cases) {
+        Board board;
+        board.import_fen(c.fen);
+        Move move = parse_uci_move(board, c.move);
+        int value = move == MOVE_NONE ? INF : see(board, move);
+        if (value != c.value || !see_ge(board, move, c.value) || see_ge(board, move, c.value + 1)) {
+            std::cout << "SEE " << c.fen << " " << c.move << ": got " << value << ", expected " << c.value << std::endl;
+            failures++;
+        }
+    }
+    std::cout << "see " << (failures ? "FAILED" : "ok") << " on " << std::size(cases) << " positions" << std::endl;
+    return failures ? 1 : 0;
+}
+
+// Heap allocations made while 'count_allocations' is set, through the replaced global operator new.
+// Every plain, array, nothrow and sized form is replaced so allocation and release always pair
+// malloc with free, which sanitizers check; the over-aligned forms keep their defaults. All of them
+// stay out of line, or GCC sees malloc and free through new and delete expressions and warns.
+std::atomic<bool> count_allocations{false};
+std::atomic<uint64_t> allocation_count{0};
+
+void *counted_malloc(std::size_t size) noexcept {
+    if (count_allocations.load(std::memory_order_relaxed)) allocation_count.fetch_add(1, std::memory_order_relaxed);
+    return std::malloc(size ? size : 1);
+}
+
+__attribute__((noinline)) void *operator new(std::size_t size) {
+    if (void *p = counted_malloc(size)) return p;
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void *operator new[](std::size_t size) {
+    if (void *p = counted_malloc(size)) return p;
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+    return counted_malloc(size);
+}
+
+__attribute__((noinline)) void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+    return counted_malloc(size);
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void *p) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, std::size_t) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void *p, std::size_t) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, const std::nothrow_t &) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void *p, const std::nothrow_t &) noexcept {
+    std::free(p);
+}
+
+// Checks search never touches the heap: counts allocations while negamax runs a fixed-depth
+// search, one iteration per depth as the driver would, minus its UCI output
+int bench_allocations() {
+    const int depth = 7;
+    tt.resize(DEFAULT_HASH_MB);
+    eval_cache.resize(DEFAULT_EVAL_CACHE_KB);
+    Board board;
+    board.import_fen(bench_fens[1]);
+    auto info = std::make_unique<SearchInfo>();
+    info->time.init(info->limits, board.white_to_move);
+
+    allocation_count = 0;
+    count_allocations = true;
+    for (int d = 1; d <= depth; ++d) {
+        if (slider_backend == PEXT_BACKEND) negamax<PEXT_BACKEND>(board, d, 0, -INF, INF, *info);
+        else negamax<MAGIC_BACKEND>(board, d, 0, -INF, INF, *info);
+    }
+    count_allocations = false;
+
+    uint64_t allocations = allocation_count;
+    std::cout << "allocations " << (allocations ? "FAILED" : "ok") << ": " << allocations << " during a depth "
+              << depth << " search (" << info->nodes << " nodes)" << std::endl;
+    return allocations ? 1 : 0;
+}
+
+int bench() {
+    if (bench_sliders() != 0) return 1;
+    init_attack_tables(detect_slider_backend());
+    if (bench_see() != 0) return 1;
+    if (bench_eval() != 0) return 1;
+    if (bench_allocations() != 0) return 1;
+    return bench_symmetry();
+}
+
+// Handles 'position [startpos | fen <fen>] [moves <move>...]'
+void uci_position(Board &board, std::istringstream &is) {
+    std::string token, fen;
+    is >> token;
+    if (token == "startpos") {
+        board = Board();
+        board.initialize();
+        is >> token; // "moves", if any
+    } else if (token == "fen") {
+        while (is >> token && token != "moves") fen += token + " ";
+        board.import_fen(fen);
+    }
+
+    StateInfo st;
+    while (is >> token) {
+        Move move = parse_uci_move(board, token);
+        if (move == MOVE_NONE) break;
+        board.make_move(move, st);
+    }
+}
+
+// Handles 'go [wtime|btime|winc|binc|movestogo|movetime|nodes|depth <n>]... [infinite]' by starting
+// the search on 'worker', which prints bestmove when it is done
+void uci_go(const Board &board, SearchInfo &info, std::istringstream &is, std::thread &worker) {
+    info.limits = SearchLimits();
+    std::string token;
+    while (is >> token) {
+        if (token == "wtime") is >> info.limits.time[0];
+        else if (token == "btime") is >> info.limits.time[1];
+        else if (token == "winc") is >> info.limits.inc[0];
+        else if (token == "binc") is >> info.limits.inc[1];
+        else if (token == "movestogo") is >> info.limits.movestogo;
+        else if (token == "movetime") is >> info.limits.movetime;
+        else if (token == "nodes") is >> info.limits.nodes;
+        else if (token == "depth") is >> info.limits.depth;
+        else if (token == "infinite") info.limits.infinite = true;
+    }
+
+    info.stopped = false;
+    worker = std::thread([&info, position = board]() mutable {
+        Move best_move = search(position, info);
+        // A finished infinite search still waits for 'stop' before answering
+        while (info.limits.infinite && !info.stopped) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        std::cout << "bestmove " << move_to_uci(best_move) << std::endl;
+    });
+}
+
+// Handles 'setoption name <name> value <value>'
+void uci_setoption(SearchInfo &info, std::istringstream &is) {
+    std::string token, name, value;
+    is >> token; // "name"
+    while (is >> token && token != "value") name += (name.empty() ? "" : " ") + token;
+    is >> value;
+
+    if (name == "Hash") tt.resize(std::stoul(value));
+    else if (name == "Eval Cache") eval_cache.resize(std::stoul(value));
+    else if (name == "Move Overhead") info.time.move_overhead = std::stoi(value);
+    else if (name == "CPU Time") info.time.cpu_time = value == "true";
+
+    for (const TunableOption &option: tunable_options) {
+        if (name == option.name) {
+            *option.value = std::max(option.min, std::min(option.max, std::stoi(value)));
+            init_reductions();
+        }
+    }
+}
+
+// Main function
+// Usage: ChessBot [--slider magic|pext] [--hash <MB>] [--eval-cache <KB>] [bench], then UCI commands on stdin
+int main(int argc, char *argv[]) {
+    SliderBackend backend = detect_slider_backend();
+    size_t hash_mb = DEFAULT_HASH_MB;
+    size_t eval_cache_kb = DEFAULT_EVAL_CACHE_KB;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "bench") return bench();
+        if (arg == "--slider" && i + 1 < argc) {
+            std::string name = argv[++i];
+            backend = name == "pext" ? PEXT_BACKEND : MAGIC_BACKEND;
+        }
+        if (arg == "--hash" && i + 1 < argc) {
+            hash_mb = std::stoul(argv[++i]);
+        }
+        if (arg == "--eval-cache" && i + 1 < argc) {
+            eval_cache_kb = std::stoul(argv[++i]);
+        }
+    }
+    if (backend == PEXT_BACKEND && !cpu_has_bmi2()) {
+        std::cout << "BMI2 not supported on this CPU, using magic bitboards" << std::endl;
+        backend = MAGIC_BACKEND;
+    }
+    init_attack_tables(backend);
+    init_reductions();
+    tt.resize(hash_mb);
+    eval_cache.resize(eval_cache_kb);
+
+    Board board;
+    board.initialize();
+    auto info = std::make_unique<SearchInfo>();
+    std::thread search_thread; // Runs 'go', so 'stop' and 'quit' are read while it searches
+
+    // Waits for a running search to end, aborting it first if 'stop' is true. An infinite search
+    // never ends by itself, so it is always aborted.
+    auto finish_search = [&](bool stop) {
+        if (stop || info->limits.infinite) info->stopped = true;
+        if (search_thread.joinable()) search_thread.join();
+    };
+
+    std::string line, token;
+    while (std::getline(std::cin, line)) {
+        std::istringstream is(line);
+        token.clear();
+        is >> token;
+        if (token == "uci") {
+            std::cout << "id name ChessBot\n"
+                      << "option name Hash type spin default " << DEFAULT_HASH_MB << " min 1 max 65536\n"
+                      << "option name Eval Cache type spin default " << DEFAULT_EVAL_CACHE_KB << " min 1 max 1048576\n"
+                      << "option name Move Overhead type spin default 10 min 0 max 5000\n"
+                      << "option name CPU Time type check default false\n";
+            for (const TunableOption &option: tunable_options) {
+                std::cout << "option name " << option.name << " type spin default " << *option.value
+                          << " min " << option.min << " max " << option.max << "\n";
+            }
+            std::cout << "uciok" << std::endl;
+        } else if (token == "isready") {
+            std::cout << "readyok" << std::endl;
+        } else if (token == "stop") {
+            finish_search(true);
+        } else if (token == "ucinewgame") {
+            finish_search(false);
+            tt.clear();
+            eval_cache.clear();
+            info->clear_ordering();
+        } else if (token == "setoption") {
+            finish_search(false);
+            uci_setoption(*info, is);
+        } else if (token == "position") {
+            finish_search(false);
+            uci_position(board, is);
+        } else if (token == "go") {
+            finish_search(false);
+            uci_go(board, *info, is, search_thread);
+        } else if (token == "quit") {
+            break;
+        }
     }
+    finish_search(token == "quit");
     return 0;
 }